@@ -0,0 +1,875 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/input.h>
+#include <linux/init.h>
+#include <linux/device.h>
+#include <linux/bitmap.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
+#include <linux/string.h>
+
+#include "hotswap.h"
+
+// One input handler for every class of hot swappable device. Each class has a
+// virtual device that evdev turns into a stable /dev/input/eventX (tkbd for
+// keyboards, tmouse for mice), and every real device that shows up is routed
+// to the classes it matches when it connects, so an event costs one handler
+// call and a pointer lookup no matter how many classes there are.
+MODULE_LICENSE("GPL");
+
+static unsigned int max_rate;
+module_param(max_rate, uint, 0644);
+MODULE_PARM_DESC(max_rate, "Most motion reports per second from tmouse, relative motion in between is summed up (0 forwards every frame)");
+
+// Pointer acceleration for tmouse, applied to each source's frames before they
+// are forwarded: up to accel_threshold counts a frame motion passes 1:1, every
+// count above it adds accel_gain percent, up to accel_max percent in total.
+// A faster mouse covers the screen in fewer, larger deltas, and so in fewer
+// frames and refreshes than when X accelerates what we already forwarded.
+static unsigned int accel_threshold = 4;
+static unsigned int accel_gain;
+static unsigned int accel_max = 400;
+
+static unsigned int ring_size;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Events in the ring mapped through /dev/hotswap, a power of two (0 for no ring)");
+
+// Events of a source are held back until its SYN_REPORT and then forwarded as
+// one frame, so two devices used at the same time can't mix their frames.
+#define FRAME_MAX 64
+
+struct frame_event {
+	unsigned int type;
+	unsigned int code;
+	int value;
+};
+
+// also the class numbers in hotswap.h
+enum hotswap_class_id {
+	HOTSWAP_KEYBOARD,
+	HOTSWAP_MOUSE,
+	HOTSWAP_CLASSES
+};
+
+struct hotswap_class {
+	const char *name;
+	struct input_id id;
+	void (*setup)(struct input_dev *dev);
+	bool coalesce;			// honours max_rate
+	bool accel;			// honours accel_gain
+
+	struct input_dev *dev;
+
+	// Serializes whole frames into dev, taken inside the source's
+	// event_lock with interrupts already off.
+	spinlock_t lock;
+
+	// With max_rate set, motion of all sources is summed up here and
+	// reported by motion_timer at most max_rate times a second. Buttons
+	// still go out as soon as their frame is complete, after the motion
+	// that came before them. All of it is protected by lock.
+	struct hrtimer motion_timer;
+	ktime_t last_motion;
+	int pending_x, pending_y, pending_wheel;
+	bool motion_pending;
+};
+
+struct hotswap_source {
+	struct input_handle handle;
+	struct list_head node;		// on hotswap_sources
+	unsigned long received;		// only written under the device's event_lock
+	struct hotswap_class *classes[HOTSWAP_CLASSES];
+	unsigned int nclasses;
+	bool accel;			// one of the classes is
+	int remainder_x, remainder_y;	// subpixel motion left over, 16.16
+	unsigned int count;
+	struct frame_event events[FRAME_MAX];
+};
+
+// Counters are per CPU so the event path never shares a cache line with
+// another CPU, they are only summed up when debugfs is read.
+// Time in hotswap_event() goes into power of two buckets of nanoseconds,
+// <256ns, <512ns, ... and the last one for everything above.
+#define HIST_SHIFT 8
+#define HIST_BUCKETS 12
+
+struct hotswap_stats {
+	unsigned long events;		// received from sources
+	unsigned long frames;		// synced out of the virtual devices
+	unsigned long coalesced;	// motion summed into a later report
+	unsigned long refused;		// binds refused by hotswap_match()
+	unsigned long connects;
+	unsigned long disconnects;
+	unsigned long hist[HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct hotswap_stats, hotswap_stats);
+
+static LIST_HEAD(hotswap_sources);
+static DEFINE_MUTEX(hotswap_sources_lock);
+static struct dentry *hotswap_debugfs;
+
+
+static void hotswap_setup_keyboard(struct input_dev *dev)
+{
+	int k;
+
+	dev->evbit[0] = BIT_MASK(EV_SYN) | BIT_MASK(EV_KEY) | BIT_MASK(EV_MSC) | BIT_MASK(EV_LED) | BIT_MASK(EV_REP);
+	for( k = 1; k < KEY_MIN_INTERESTING; k++ ){
+		dev->keybit[BIT_WORD(k)] |= BIT_MASK(k);
+	}
+
+	dev->mscbit[BIT_WORD(MSC_SCAN)] |= BIT_MASK(MSC_SCAN);
+
+	dev->ledbit[BIT_WORD(LED_NUML)] |= BIT_MASK(LED_NUML);
+	dev->ledbit[BIT_WORD(LED_CAPSL)] |= BIT_MASK(LED_CAPSL);
+	dev->ledbit[BIT_WORD(LED_SCROLLL)] |= BIT_MASK(LED_SCROLLL);
+
+	dev->rep[REP_DELAY]= 250;
+	dev->rep[REP_PERIOD]= 33;
+}
+
+static void hotswap_setup_mouse(struct input_dev *dev)
+{
+	dev->evbit[0] = BIT_MASK(EV_SYN) | BIT_MASK(EV_KEY) | BIT_MASK(EV_REL) | BIT_MASK(EV_MSC);
+	dev->keybit[BIT_WORD(BTN_LEFT)] |= BIT_MASK(BTN_LEFT);
+	dev->keybit[BIT_WORD(BTN_RIGHT)] |= BIT_MASK(BTN_RIGHT);
+	dev->keybit[BIT_WORD(BTN_MIDDLE)] |= BIT_MASK(BTN_MIDDLE);
+	dev->keybit[BIT_WORD(BTN_SIDE)] |= BIT_MASK(BTN_SIDE);
+	dev->keybit[BIT_WORD(BTN_EXTRA)] |= BIT_MASK(BTN_EXTRA);
+	dev->keybit[BIT_WORD(BTN_FORWARD)] |= BIT_MASK(BTN_FORWARD);
+	dev->keybit[BIT_WORD(BTN_BACK)] |= BIT_MASK(BTN_BACK);
+	dev->keybit[BIT_WORD(BTN_TASK)] |= BIT_MASK(BTN_TASK);
+
+	dev->relbit[BIT_WORD(REL_X)] |= BIT_MASK(REL_X);
+	dev->relbit[BIT_WORD(REL_Y)] |= BIT_MASK(REL_Y);
+	dev->relbit[BIT_WORD(REL_WHEEL)] |= BIT_MASK(REL_WHEEL);
+
+	dev->mscbit[BIT_WORD(MSC_SCAN)] |= BIT_MASK(MSC_SCAN);
+}
+
+// Indexed by class, a device joins every class whose entry it matches.
+static const struct input_device_id hotswap_ids[] = {
+        [HOTSWAP_KEYBOARD] = {
+                 .flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+                                 INPUT_DEVICE_ID_MATCH_KEYBIT,
+                 .evbit = { BIT_MASK(EV_KEY)  },
+                 .keybit = { [BIT_WORD(KEY_LEFTCTRL  )] = BIT_MASK(KEY_LEFTCTRL  ) },
+         },      /* A keyboard with leftCTRL */
+        [HOTSWAP_MOUSE] = {
+                 .flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+                                 INPUT_DEVICE_ID_MATCH_KEYBIT |
+                                 INPUT_DEVICE_ID_MATCH_RELBIT,
+                 .evbit = { BIT_MASK(EV_KEY) | BIT_MASK(EV_REL) },
+                 .keybit = { [BIT_WORD(BTN_LEFT)] = BIT_MASK(BTN_LEFT) },
+                 .relbit = { BIT_MASK(REL_X) | BIT_MASK(REL_Y) },
+         },      /* A mouse like device, at least one button,
+                    two relative axes */
+        { },                    /* Terminating zero entry */
+};
+
+MODULE_DEVICE_TABLE(input, hotswap_ids);
+
+static struct hotswap_class hotswap_classes[HOTSWAP_CLASSES] = {
+	[HOTSWAP_KEYBOARD] = {
+		.name = "tkbd",
+		.id = { .bustype = 0x03, .vendor = 0x0, .product = 0x03, .version = 0x110 },
+		.setup = hotswap_setup_keyboard,
+	},
+	[HOTSWAP_MOUSE] = {
+		.name = "tmouse",
+		.id = { .bustype = 0x03, .vendor = 0x0, .product = 0x03, .version = 0x110 },
+		.setup = hotswap_setup_mouse,
+		.coalesce = true,
+		.accel = true,
+	},
+};
+
+
+// Everything that goes out of a virtual device is also written to the ring,
+// if there is one. Classes write under their own locks, ring_lock makes them
+// a single producer. head is kept here as well so a reader can't make us
+// write outside the ring, the shared copy is only published.
+static struct hotswap_ring *ring;
+static DEFINE_SPINLOCK(ring_lock);
+static u32 ring_head;
+static atomic_t ring_readers = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(ring_wait);
+
+static void hotswap_ring_push(struct hotswap_class *cls, unsigned int type, unsigned int code, int value)
+{
+	struct hotswap_ring_event *ev;
+	u32 tail;
+
+	spin_lock(&ring_lock);
+
+	tail = ACCESS_ONCE(ring->tail);
+	if (ring_head - tail >= ring_size) {
+		ring->dropped++;
+	} else {
+		ev = &ring->events[ring_head & (ring_size - 1)];
+		ev->time = ktime_to_ns(ktime_get());
+		ev->class = cls - hotswap_classes;
+		ev->type = type;
+		ev->code = code;
+		ev->value = value;
+
+		// the slot has to be visible before the head that covers it
+		smp_wmb();
+		ring_head++;
+		ring->head = ring_head;
+	}
+
+	spin_unlock(&ring_lock);
+}
+
+static void hotswap_report(struct hotswap_class *cls, unsigned int type, unsigned int code, int value)
+{
+	input_event(cls->dev, type, code, value);
+	if (ring)
+		hotswap_ring_push(cls, type, code, value);
+}
+
+static void hotswap_sync(struct hotswap_class *cls)
+{
+	input_sync(cls->dev);
+	__this_cpu_inc(hotswap_stats.frames);
+	if (ring) {
+		hotswap_ring_push(cls, EV_SYN, SYN_REPORT, 0);
+		wake_up_interruptible(&ring_wait);
+	}
+}
+
+
+// The gain for every speed (the larger axis plus half the smaller one, in
+// counts per frame) up to ACCEL_SPEEDS, in 16.16 fixed point. It is rebuilt
+// whenever an accel_ parameter changes and swapped in under RCU, the event
+// path only reads it.
+#define ACCEL_SPEEDS 64
+#define ACCEL_ONE (1 << 16)
+
+static u32 __rcu *accel_lut;
+static DEFINE_MUTEX(accel_mutex);
+
+static int hotswap_accel_build(void)
+{
+	u32 *lut = NULL, *old;
+	unsigned int speed, pct, max;
+
+	mutex_lock(&accel_mutex);
+
+	if (accel_gain) {
+		lut = kmalloc(ACCEL_SPEEDS * sizeof(*lut), GFP_KERNEL);
+		if (!lut) {
+			mutex_unlock(&accel_mutex);
+			return -ENOMEM;
+		}
+
+		// at most 100 times, so none of it overflows 32 bits
+		max = clamp_t(unsigned int, accel_max, 100, 10000);
+		for (speed = 0; speed < ACCEL_SPEEDS; speed++) {
+			pct = 100;
+			if (speed > accel_threshold)
+				pct += (speed - accel_threshold) * min(accel_gain, 10000u);
+			lut[speed] = min(pct, max) * ACCEL_ONE / 100;
+		}
+	}
+
+	old = rcu_dereference_protected(accel_lut, lockdep_is_held(&accel_mutex));
+	rcu_assign_pointer(accel_lut, lut);
+	mutex_unlock(&accel_mutex);
+
+	if (old) {
+		synchronize_rcu();
+		kfree(old);
+	}
+
+	return 0;
+}
+
+static int hotswap_accel_set(const char *val, const struct kernel_param *kp)
+{
+	int error = param_set_uint(val, kp);
+
+	return error ? error : hotswap_accel_build();
+}
+
+static const struct kernel_param_ops hotswap_accel_ops = {
+	.set = hotswap_accel_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(accel_threshold, &hotswap_accel_ops, &accel_threshold, 0644);
+MODULE_PARM_DESC(accel_threshold, "Counts per frame tmouse forwards unaccelerated");
+module_param_cb(accel_gain, &hotswap_accel_ops, &accel_gain, 0644);
+MODULE_PARM_DESC(accel_gain, "Percent tmouse adds per count above accel_threshold (0 for no acceleration)");
+module_param_cb(accel_max, &hotswap_accel_ops, &accel_max, 0644);
+MODULE_PARM_DESC(accel_max, "Most tmouse accelerates, in percent");
+
+static int hotswap_accel_axis(int delta, u32 gain, int *remainder)
+{
+	s64 scaled = (s64)delta * gain + *remainder;
+	int out = (int)(scaled >> 16);
+
+	// what didn't make a whole count is carried into the next frame
+	*remainder = (int)(scaled - ((s64)out << 16));
+	return out;
+}
+
+// Scales the REL_X/REL_Y of the frame buffered in source.
+static void hotswap_accelerate(struct hotswap_source *source)
+{
+	struct frame_event *ev, *rel_x = NULL, *rel_y = NULL;
+	unsigned int i, ax, ay, speed;
+	u32 *lut;
+	u32 gain;
+
+	for (i = 0; i < source->count; i++) {
+		ev = &source->events[i];
+		if (ev->type != EV_REL)
+			continue;
+		if (ev->code == REL_X)
+			rel_x = ev;
+		else if (ev->code == REL_Y)
+			rel_y = ev;
+	}
+
+	if (!rel_x && !rel_y)
+		return;
+
+	rcu_read_lock();
+	lut = rcu_dereference(accel_lut);
+	if (lut) {
+		ax = rel_x ? abs(rel_x->value) : 0;
+		ay = rel_y ? abs(rel_y->value) : 0;
+		speed = ax > ay ? ax + ay / 2 : ay + ax / 2;
+		gain = lut[min_t(unsigned int, speed, ACCEL_SPEEDS - 1)];
+
+		if (rel_x)
+			rel_x->value = hotswap_accel_axis(rel_x->value, gain, &source->remainder_x);
+		if (rel_y)
+			rel_y->value = hotswap_accel_axis(rel_y->value, gain, &source->remainder_y);
+	}
+	rcu_read_unlock();
+}
+
+
+static bool hotswap_coalesced(const struct frame_event *ev)
+{
+	return ev->type == EV_REL &&
+		(ev->code == REL_X || ev->code == REL_Y || ev->code == REL_WHEEL);
+}
+
+static void hotswap_emit_motion(struct hotswap_class *cls)
+{
+	if (cls->pending_x)
+		hotswap_report(cls, EV_REL, REL_X, cls->pending_x);
+	if (cls->pending_y)
+		hotswap_report(cls, EV_REL, REL_Y, cls->pending_y);
+	if (cls->pending_wheel)
+		hotswap_report(cls, EV_REL, REL_WHEEL, cls->pending_wheel);
+
+	cls->pending_x = cls->pending_y = cls->pending_wheel = 0;
+	cls->motion_pending = false;
+	cls->last_motion = ktime_get();
+}
+
+static enum hrtimer_restart hotswap_motion_timer(struct hrtimer *timer)
+{
+	struct hotswap_class *cls = container_of(timer, struct hotswap_class, motion_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&cls->lock, flags);
+	if (cls->motion_pending) {
+		hotswap_emit_motion(cls);
+		hotswap_sync(cls);
+	}
+	spin_unlock_irqrestore(&cls->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static void hotswap_flush_coalesced(struct hotswap_class *cls, struct hotswap_source *source,
+				    bool sync, unsigned int rate)
+{
+	struct frame_event *ev;
+	bool others = false;
+	s64 period, since;
+	unsigned int i;
+
+	for (i = 0; i < source->count; i++) {
+		ev = &source->events[i];
+		if (!hotswap_coalesced(ev)) {
+			others = true;
+			continue;
+		}
+
+		if (ev->code == REL_X)
+			cls->pending_x += ev->value;
+		else if (ev->code == REL_Y)
+			cls->pending_y += ev->value;
+		else
+			cls->pending_wheel += ev->value;
+		if (cls->motion_pending)
+			__this_cpu_inc(hotswap_stats.coalesced);
+		cls->motion_pending = true;
+	}
+
+	if (others) {
+		if (cls->motion_pending)
+			hotswap_emit_motion(cls);
+		for (i = 0; i < source->count; i++)
+			if (!hotswap_coalesced(&source->events[i]))
+				hotswap_report(cls, source->events[i].type,
+					       source->events[i].code, source->events[i].value);
+		if (sync)
+			hotswap_sync(cls);
+		hrtimer_try_to_cancel(&cls->motion_timer);
+		return;
+	}
+
+	if (!cls->motion_pending)
+		return;
+
+	period = NSEC_PER_SEC / rate;
+	since = ktime_to_ns(ktime_sub(ktime_get(), cls->last_motion));
+
+	if (since >= period) {
+		hotswap_emit_motion(cls);
+		hotswap_sync(cls);
+	} else if (!hrtimer_active(&cls->motion_timer)) {
+		hrtimer_start(&cls->motion_timer, ns_to_ktime(period - since), HRTIMER_MODE_REL);
+	}
+}
+
+static void hotswap_flush(struct hotswap_source *source, bool sync)
+{
+	unsigned int rate = ACCESS_ONCE(max_rate);
+	struct hotswap_class *cls;
+	unsigned int c, i;
+
+	if (source->accel)
+		hotswap_accelerate(source);
+
+	for (c = 0; c < source->nclasses; c++) {
+		cls = source->classes[c];
+
+		spin_lock(&cls->lock);
+		if (rate && cls->coalesce) {
+			hotswap_flush_coalesced(cls, source, sync, rate);
+		} else {
+			for (i = 0; i < source->count; i++)
+				hotswap_report(cls, source->events[i].type,
+					       source->events[i].code, source->events[i].value);
+			if (sync)
+				hotswap_sync(cls);
+		}
+		spin_unlock(&cls->lock);
+	}
+
+	source->count = 0;
+}
+
+static void hotswap_event(struct input_handle *handle, unsigned int type, unsigned int code, int value)
+{
+	struct hotswap_source *source = container_of(handle, struct hotswap_source, handle);
+	u64 start = local_clock();
+	unsigned long spent;
+	int bucket;
+
+	// called with the device's event_lock held and interrupts off
+	source->received++;
+	__this_cpu_inc(hotswap_stats.events);
+
+	if (type == EV_SYN && code == SYN_REPORT) {
+		hotswap_flush(source, true);
+		goto out;
+	}
+
+	// an overlong frame goes out in pieces rather than losing events
+	if (source->count == FRAME_MAX)
+		hotswap_flush(source, false);
+
+	source->events[source->count].type = type;
+	source->events[source->count].code = code;
+	source->events[source->count].value = value;
+	source->count++;
+
+ out:
+	spent = (unsigned long)(local_clock() - start) >> HIST_SHIFT;
+	bucket = spent ? min_t(int, fls_long(spent), HIST_BUCKETS - 1) : 0;
+	__this_cpu_inc(hotswap_stats.hist[bucket]);
+}
+
+
+// The input core only tells connect() about the first entry a device matched,
+// a keyboard with a built-in pointing stick belongs to both classes.
+static bool hotswap_class_matches(const struct input_device_id *id, struct input_dev *dev)
+{
+	if ((id->flags & INPUT_DEVICE_ID_MATCH_EVBIT) &&
+	    !bitmap_subset(id->evbit, dev->evbit, EV_CNT))
+		return false;
+	if ((id->flags & INPUT_DEVICE_ID_MATCH_KEYBIT) &&
+	    !bitmap_subset(id->keybit, dev->keybit, KEY_CNT))
+		return false;
+	if ((id->flags & INPUT_DEVICE_ID_MATCH_RELBIT) &&
+	    !bitmap_subset(id->relbit, dev->relbit, REL_CNT))
+		return false;
+
+	return true;
+}
+
+// Our own virtual devices are never sources, so the event path needs no
+// filtering: binding to them would loop events back into them. Neither is any
+// other device by their names, such as those of the old tkbd and tmouse
+// modules or of a previous load of this one, which would feed each other.
+static bool hotswap_match(struct input_handler *handler, struct input_dev *dev)
+{
+	unsigned int c;
+
+	for (c = 0; c < HOTSWAP_CLASSES; c++) {
+		if (dev == hotswap_classes[c].dev ||
+		    (dev->name && strcmp(dev->name, hotswap_classes[c].name) == 0)) {
+			this_cpu_inc(hotswap_stats.refused);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static int hotswap_connect(struct input_handler *handler, struct input_dev *dev,
+                           const struct input_device_id *id)
+{
+        struct hotswap_source *source;
+        struct input_handle *handle;
+        unsigned int c;
+        int error;
+
+        source = kzalloc(sizeof(struct hotswap_source), GFP_KERNEL);
+        if (!source)
+                return -ENOMEM;
+
+        for (c = 0; c < HOTSWAP_CLASSES; c++)
+                if (hotswap_class_matches(&hotswap_ids[c], dev)) {
+                        source->classes[source->nclasses++] = &hotswap_classes[c];
+                        source->accel |= hotswap_classes[c].accel;
+                }
+
+        handle = &source->handle;
+        handle->dev = dev;
+        handle->handler = handler;
+        handle->name = "hotswap";
+
+        error = input_register_handle(handle);
+        if (error)
+                goto err_free_handle;
+
+        error = input_open_device(handle);
+        if (error)
+                goto err_unregister_handle;
+
+        mutex_lock(&hotswap_sources_lock);
+        list_add_tail(&source->node, &hotswap_sources);
+        mutex_unlock(&hotswap_sources_lock);
+        this_cpu_inc(hotswap_stats.connects);
+
+        printk(KERN_DEBUG pr_fmt("Connected device: %s (%s at %s) to %s%s\n"),
+               dev_name(&dev->dev),
+               dev->name ?: "unknown",
+               dev->phys ?: "unknown",
+               source->classes[0]->name,
+               source->nclasses > 1 ? " and more" : "");
+
+        return 0;
+
+ err_unregister_handle:
+        input_unregister_handle(handle);
+ err_free_handle:
+        kfree(source);
+        return error;
+}
+
+static void hotswap_disconnect(struct input_handle *handle)
+{
+        struct hotswap_source *source = container_of(handle, struct hotswap_source, handle);
+
+        printk(KERN_DEBUG pr_fmt("Disconnected device: %s\n"),
+               dev_name(&handle->dev->dev));
+
+        mutex_lock(&hotswap_sources_lock);
+        list_del(&source->node);
+        mutex_unlock(&hotswap_sources_lock);
+        this_cpu_inc(hotswap_stats.disconnects);
+
+        input_close_device(handle);
+        input_unregister_handle(handle);
+        kfree(source);
+}
+
+static struct input_handler hotswap_handler = {
+        .event =        hotswap_event,
+        .match =        hotswap_match,
+        .connect =      hotswap_connect,
+        .disconnect =   hotswap_disconnect,
+        .name =         "hotswap",
+        .id_table =     hotswap_ids,
+};
+
+
+// /sys/kernel/debug/hotswap/stats
+static int hotswap_stats_show(struct seq_file *m, void *v)
+{
+	struct hotswap_stats sum, *st;
+	struct hotswap_source *source;
+	unsigned int cpu, b;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		st = &per_cpu(hotswap_stats, cpu);
+		sum.events += st->events;
+		sum.frames += st->frames;
+		sum.coalesced += st->coalesced;
+		sum.refused += st->refused;
+		sum.connects += st->connects;
+		sum.disconnects += st->disconnects;
+		for (b = 0; b < HIST_BUCKETS; b++)
+			sum.hist[b] += st->hist[b];
+	}
+
+	seq_printf(m, "events %lu frames %lu coalesced %lu refused %lu connects %lu disconnects %lu\n",
+		   sum.events, sum.frames, sum.coalesced, sum.refused, sum.connects, sum.disconnects);
+
+	seq_printf(m, "event_ns");
+	for (b = 0; b < HIST_BUCKETS - 1; b++)
+		seq_printf(m, " <%lu:%lu", 1UL << (HIST_SHIFT + b), sum.hist[b]);
+	seq_printf(m, " >=%lu:%lu\n", 1UL << (HIST_SHIFT + b - 1), sum.hist[b]);
+
+	mutex_lock(&hotswap_sources_lock);
+	list_for_each_entry(source, &hotswap_sources, node)
+		seq_printf(m, "source %s \"%s\" received %lu\n",
+			   dev_name(&source->handle.dev->dev),
+			   source->handle.dev->name ?: "unknown",
+			   source->received);
+	mutex_unlock(&hotswap_sources_lock);
+
+	return 0;
+}
+
+static int hotswap_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hotswap_stats_show, NULL);
+}
+
+static const struct file_operations hotswap_stats_fops = {
+	.owner =	THIS_MODULE,
+	.open =		hotswap_stats_open,
+	.read =		seq_read,
+	.llseek =	seq_lseek,
+	.release =	single_release,
+};
+
+// The counters are only a debugging aid, the module works without debugfs.
+static void hotswap_debugfs_init(void)
+{
+	hotswap_debugfs = debugfs_create_dir("hotswap", NULL);
+	if (IS_ERR_OR_NULL(hotswap_debugfs)) {
+		hotswap_debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_file("stats", 0444, hotswap_debugfs, NULL, &hotswap_stats_fops);
+}
+
+
+// /dev/hotswap, one reader at a time maps the ring and polls for frames.
+static int hotswap_ring_open(struct inode *inode, struct file *file)
+{
+	unsigned long flags;
+
+	if (atomic_cmpxchg(&ring_readers, 0, 1))
+		return -EBUSY;
+
+	// start with what comes next rather than whatever the last reader left
+	spin_lock_irqsave(&ring_lock, flags);
+	ring->tail = ring_head;
+	ring->dropped = 0;
+	spin_unlock_irqrestore(&ring_lock, flags);
+
+	return nonseekable_open(inode, file);
+}
+
+static int hotswap_ring_release(struct inode *inode, struct file *file)
+{
+	atomic_set(&ring_readers, 0);
+	return 0;
+}
+
+static unsigned int hotswap_ring_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &ring_wait, wait);
+
+	return ACCESS_ONCE(ring->head) != ACCESS_ONCE(ring->tail) ? POLLIN | POLLRDNORM : 0;
+}
+
+static int hotswap_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return remap_vmalloc_range(vma, ring, vma->vm_pgoff);
+}
+
+static const struct file_operations hotswap_ring_fops = {
+	.owner =	THIS_MODULE,
+	.open =		hotswap_ring_open,
+	.release =	hotswap_ring_release,
+	.poll =		hotswap_ring_poll,
+	.mmap =		hotswap_ring_mmap,
+	.llseek =	no_llseek,
+};
+
+static struct miscdevice hotswap_ring_dev = {
+	.minor =	MISC_DYNAMIC_MINOR,
+	.name =		"hotswap",
+	.fops =		&hotswap_ring_fops,
+};
+
+static int hotswap_ring_init(void)
+{
+	int error;
+
+	if (!ring_size)
+		return 0;
+
+	if (!is_power_of_2(ring_size)) {
+		printk(KERN_ERR "hotswap.c: ring_size must be a power of two\n");
+		return -EINVAL;
+	}
+
+	// vmalloc_user() zeroes it and rounds it up to whole pages for mmap
+	ring = vmalloc_user(sizeof(*ring) + ring_size * sizeof(ring->events[0]));
+	if (!ring) {
+		printk(KERN_ERR "hotswap.c: Not enough memory for the ring\n");
+		return -ENOMEM;
+	}
+	ring->size = ring_size;
+
+	error = misc_register(&hotswap_ring_dev);
+	if (error) {
+		printk(KERN_ERR "hotswap.c: Failed to register the ring device\n");
+		vfree(ring);
+		ring = NULL;
+	}
+
+	return error;
+}
+
+static void hotswap_ring_free(void)
+{
+	if (!ring)
+		return;
+
+	misc_deregister(&hotswap_ring_dev);
+	vfree(ring);
+	ring = NULL;
+}
+
+
+static void hotswap_free_classes(unsigned int count)
+{
+	struct hotswap_class *cls;
+
+	while (count--) {
+		cls = &hotswap_classes[count];
+		hrtimer_cancel(&cls->motion_timer);
+		input_unregister_device(cls->dev);
+		cls->dev = NULL;
+	}
+}
+
+static int __init hotswap_init(void)
+{
+	struct hotswap_class *cls;
+	unsigned int c;
+	int error;
+
+	// before any class can report into it
+	error = hotswap_ring_init();
+	if (error)
+		goto err_free_lut;
+
+	for (c = 0; c < HOTSWAP_CLASSES; c++) {
+		cls = &hotswap_classes[c];
+
+		spin_lock_init(&cls->lock);
+		hrtimer_init(&cls->motion_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		cls->motion_timer.function = hotswap_motion_timer;
+
+		cls->dev = input_allocate_device();
+		if (!cls->dev) {
+			printk(KERN_ERR "hotswap.c: Not enough memory for %s\n", cls->name);
+			error = -ENOMEM;
+			goto err_free_classes;
+		}
+
+		cls->dev->name = cls->name;
+		cls->dev->id = cls->id;
+		cls->setup(cls->dev);
+
+		error = input_register_device(cls->dev);
+		if (error) {
+			printk(KERN_ERR "hotswap.c: Failed to register %s\n", cls->name);
+			input_free_device(cls->dev);
+			cls->dev = NULL;
+			goto err_free_classes;
+		}
+	}
+
+	error = input_register_handler(&hotswap_handler);
+	if (error) {
+		printk(KERN_ERR "hotswap.c: Failed to register handler\n");
+		goto err_free_classes;
+	}
+
+	hotswap_debugfs_init();
+
+	return 0;
+
+ err_free_classes:
+	hotswap_free_classes(c);
+	hotswap_ring_free();
+ err_free_lut:
+	kfree(rcu_dereference_protected(accel_lut, 1));
+	return error;
+}
+
+static void __exit hotswap_exit(void)
+{
+	debugfs_remove_recursive(hotswap_debugfs);
+	input_unregister_handler(&hotswap_handler);
+
+	hotswap_free_classes(HOTSWAP_CLASSES);
+	hotswap_ring_free();
+
+	// no source is left to read it
+	kfree(rcu_dereference_protected(accel_lut, 1));
+}
+
+module_init(hotswap_init);
+module_exit(hotswap_exit);
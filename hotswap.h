@@ -0,0 +1,36 @@
+#ifndef HOTSWAP_H
+#define HOTSWAP_H
+
+#include <linux/types.h>
+
+// Layout of the ring that /dev/hotswap maps, shared by the module and its
+// readers. The module writes events and then advances head, the reader
+// consumes from tail and writes tail back when it is done with them. Both
+// only ever grow, a slot is events[index & (size - 1)].
+//
+// The ring has one reader at a time. When it falls size events behind,
+// new events are dropped and counted until it catches up.
+
+#define HOTSWAP_RING_DEVICE "/dev/hotswap"
+
+// class of the virtual device an event went out of
+#define HOTSWAP_RING_KEYBOARD 0
+#define HOTSWAP_RING_MOUSE    1
+
+struct hotswap_ring_event {
+	__u64 time;		// CLOCK_MONOTONIC nanoseconds
+	__u8 class;
+	__u8 type;
+	__u16 code;
+	__s32 value;
+};
+
+struct hotswap_ring {
+	__u32 size;		// slots, a power of two
+	__u32 head;		// written by the module
+	__u32 tail;		// written by the reader
+	__u32 dropped;
+	struct hotswap_ring_event events[0];
+};
+
+#endif
@@ -0,0 +1,438 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/input.h>
+#include <linux/init.h>
+#include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+// Measures the forwarding path of the hotswap module without real devices.
+// It registers fake mice that hotswap picks up as sources, some of them
+// keyboards with a pointing stick that match both of hotswap's classes, a
+// kthread plays frames into them round robin and a handler of our own counts
+// what comes out of tmouse and tkbd. input_event() runs the handlers
+// synchronously, so the time the kthread takes is the cost of forwarding,
+// including whatever else is bound to the devices (evdev, mousedev).
+//
+// Only generic input APIs are used so it loads in any kernel hotswap does,
+// an x86 VM as well as the Kindle. Load hotswap with max_rate=0, then
+//
+//   echo 1000000 > /sys/kernel/debug/hotswap_bench/run
+//   cat /sys/kernel/debug/hotswap_bench/results
+MODULE_LICENSE("GPL");
+
+static unsigned int sources = 4;
+module_param(sources, uint, 0444);
+MODULE_PARM_DESC(sources, "Fake mice to register as sources");
+
+static unsigned int keyboards = 1;
+module_param(keyboards, uint, 0444);
+MODULE_PARM_DESC(keyboards, "How many of the sources are keyboards as well, forwarded through tkbd too");
+
+#define SOURCES_MAX 64
+
+// Every frame carries its source and a sequence number in MSC_SCAN, which
+// hotswap forwards untouched, so lost and reordered frames can be told apart.
+#define SEQ_BITS 24
+#define SEQ_MASK ((1 << SEQ_BITS) - 1)
+
+static struct input_dev *bench_devs[SOURCES_MAX];
+
+// hotswap's virtual devices we count the frames of
+enum bench_output {
+	BENCH_MOUSE,
+	BENCH_KEYBOARD,
+	BENCH_OUTPUTS
+};
+
+static const char *const bench_names[BENCH_OUTPUTS] = {
+	[BENCH_MOUSE] = "tmouse",
+	[BENCH_KEYBOARD] = "tkbd",
+};
+
+struct bench_handle {
+	struct input_handle handle;
+	enum bench_output output;
+};
+
+static DEFINE_MUTEX(bench_mutex);		// run and results
+static struct task_struct *bench_task;
+static unsigned long bench_frames;		// to send in this run
+
+// written by the kthread, bench_running is cleared last with a barrier in
+// front so whoever sees it cleared sees the results as well
+static unsigned long bench_sent;
+static ktime_t bench_start, bench_end;
+static bool bench_running;
+
+// written by bench_event(), each output under its device's event_lock
+static unsigned long bench_events[BENCH_OUTPUTS], bench_received[BENCH_OUTPUTS];
+static unsigned long bench_lost[BENCH_OUTPUTS], bench_reordered[BENCH_OUTPUTS];
+static u32 bench_expected[BENCH_OUTPUTS][SOURCES_MAX];
+
+static struct dentry *bench_debugfs;
+
+
+static int bench_thread(void *data)
+{
+	u32 seq[SOURCES_MAX] = { 0 };
+	struct input_dev *dev;
+	unsigned long frame;
+	unsigned int s;
+
+	bench_start = ktime_get();
+
+	for (frame = 0; frame < bench_frames && !kthread_should_stop(); frame++) {
+		s = frame % sources;
+		dev = bench_devs[s];
+
+		input_event(dev, EV_MSC, MSC_SCAN, s << SEQ_BITS | (seq[s]++ & SEQ_MASK));
+		input_event(dev, EV_REL, REL_X, 1);
+		input_event(dev, EV_REL, REL_Y, 1);
+		input_sync(dev);
+
+		if ((frame & 1023) == 0)
+			cond_resched();
+	}
+
+	bench_end = ktime_get();
+	bench_sent = frame;
+
+	// pairs with the smp_rmb() of the readers
+	smp_wmb();
+	ACCESS_ONCE(bench_running) = false;
+
+	// kthread_stop() expects us to still be around
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void bench_stop(void)
+{
+	if (bench_task) {
+		kthread_stop(bench_task);
+		bench_task = NULL;
+	}
+}
+
+
+static void bench_event(struct input_handle *handle, unsigned int type, unsigned int code, int value)
+{
+	enum bench_output o = container_of(handle, struct bench_handle, handle)->output;
+	unsigned int s;
+	u32 seq, gap;
+
+	bench_events[o]++;
+
+	if (type == EV_SYN && code == SYN_REPORT) {
+		bench_received[o]++;
+		return;
+	}
+
+	if (type != EV_MSC || code != MSC_SCAN)
+		return;
+
+	s = (u32)value >> SEQ_BITS;
+	seq = value & SEQ_MASK;
+	if (s >= sources)
+		return;
+
+	// sequence numbers wrap, anything more than half way round is behind
+	gap = (seq - bench_expected[o][s]) & SEQ_MASK;
+	if (gap > SEQ_MASK / 2) {
+		bench_reordered[o]++;
+		return;
+	}
+
+	bench_lost[o] += gap;
+	bench_expected[o][s] = (seq + 1) & SEQ_MASK;
+}
+
+static int bench_output(struct input_dev *dev)
+{
+	int o;
+
+	if (!dev->name)
+		return -1;
+
+	for (o = 0; o < BENCH_OUTPUTS; o++)
+		if (strcmp(dev->name, bench_names[o]) == 0)
+			return o;
+
+	return -1;
+}
+
+// Only tmouse and tkbd, the fake sources are hotswap's.
+static bool bench_match(struct input_handler *handler, struct input_dev *dev)
+{
+	return bench_output(dev) >= 0;
+}
+
+static int bench_connect(struct input_handler *handler, struct input_dev *dev,
+                         const struct input_device_id *id)
+{
+        struct bench_handle *bench;
+        struct input_handle *handle;
+        int error;
+
+        bench = kzalloc(sizeof(struct bench_handle), GFP_KERNEL);
+        if (!bench)
+                return -ENOMEM;
+
+        bench->output = bench_output(dev);
+        handle = &bench->handle;
+        handle->dev = dev;
+        handle->handler = handler;
+        handle->name = "hotswap_bench";
+
+        error = input_register_handle(handle);
+        if (error)
+                goto err_free_handle;
+
+        error = input_open_device(handle);
+        if (error)
+                goto err_unregister_handle;
+
+        printk(KERN_DEBUG pr_fmt("Reading %s\n"), dev_name(&dev->dev));
+
+        return 0;
+
+ err_unregister_handle:
+        input_unregister_handle(handle);
+ err_free_handle:
+        kfree(bench);
+        return error;
+}
+
+static void bench_disconnect(struct input_handle *handle)
+{
+        input_close_device(handle);
+        input_unregister_handle(handle);
+        kfree(container_of(handle, struct bench_handle, handle));
+}
+
+static const struct input_device_id bench_ids[] = {
+        {
+                 .flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+                 .evbit = { BIT_MASK(EV_REL) },
+        },      /* narrowed down to tmouse by bench_match */
+        {
+                 .flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+                 .evbit = { BIT_MASK(EV_KEY) },
+        },      /* and to tkbd */
+        { },                    /* Terminating zero entry */
+};
+
+static struct input_handler bench_handler = {
+        .event =        bench_event,
+        .match =        bench_match,
+        .connect =      bench_connect,
+        .disconnect =   bench_disconnect,
+        .name =         "hotswap_bench",
+        .id_table =     bench_ids,
+};
+
+
+// /sys/kernel/debug/hotswap_bench/run, frames to send
+static ssize_t bench_run_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	unsigned long frames;
+	int error;
+
+	error = kstrtoul_from_user(buf, count, 10, &frames);
+	if (error)
+		return error;
+
+	mutex_lock(&bench_mutex);
+
+	if (ACCESS_ONCE(bench_running)) {
+		mutex_unlock(&bench_mutex);
+		return -EBUSY;
+	}
+	smp_rmb();
+
+	bench_stop();
+
+	bench_frames = frames;
+	bench_sent = 0;
+	memset(bench_events, 0, sizeof(bench_events));
+	memset(bench_received, 0, sizeof(bench_received));
+	memset(bench_lost, 0, sizeof(bench_lost));
+	memset(bench_reordered, 0, sizeof(bench_reordered));
+	memset(bench_expected, 0, sizeof(bench_expected));
+	bench_running = true;
+
+	bench_task = kthread_run(bench_thread, NULL, "hotswap_bench");
+	if (IS_ERR(bench_task)) {
+		error = PTR_ERR(bench_task);
+		bench_task = NULL;
+		bench_running = false;
+		mutex_unlock(&bench_mutex);
+		return error;
+	}
+
+	mutex_unlock(&bench_mutex);
+
+	return count;
+}
+
+static const struct file_operations bench_run_fops = {
+	.owner =	THIS_MODULE,
+	.write =	bench_run_write,
+	.llseek =	no_llseek,
+};
+
+// /sys/kernel/debug/hotswap_bench/results
+static int bench_results_show(struct seq_file *m, void *v)
+{
+	u64 ns, per_event = 0, per_second = 0;
+	unsigned long sent;
+	unsigned int o;
+
+	mutex_lock(&bench_mutex);
+
+	if (ACCESS_ONCE(bench_running)) {
+		seq_printf(m, "running\n");
+		mutex_unlock(&bench_mutex);
+		return 0;
+	}
+	smp_rmb();
+
+	// a frame is 4 events: MSC_SCAN, REL_X, REL_Y and SYN_REPORT
+	sent = bench_sent * 4;
+	ns = ktime_to_ns(ktime_sub(bench_end, bench_start));
+	if (sent)
+		per_event = div64_u64(ns, sent);
+	if (ns)
+		per_second = div64_u64((u64)sent * NSEC_PER_SEC, ns);
+
+	seq_printf(m, "sources %u keyboards %u frames %lu events %lu ns %llu\n",
+		   sources, keyboards, bench_sent, sent, ns);
+	seq_printf(m, "events/s %llu ns/event %llu\n", per_second, per_event);
+	for (o = 0; o < BENCH_OUTPUTS; o++)
+		seq_printf(m, "forwarded %s events %lu frames %lu lost %lu reordered %lu\n", bench_names[o],
+			   bench_events[o], bench_received[o], bench_lost[o], bench_reordered[o]);
+
+	mutex_unlock(&bench_mutex);
+
+	return 0;
+}
+
+static int bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bench_results_show, NULL);
+}
+
+static const struct file_operations bench_results_fops = {
+	.owner =	THIS_MODULE,
+	.open =		bench_results_open,
+	.read =		seq_read,
+	.llseek =	seq_lseek,
+	.release =	single_release,
+};
+
+
+static void bench_free_devs(unsigned int count)
+{
+	while (count--) {
+		input_unregister_device(bench_devs[count]);
+		bench_devs[count] = NULL;
+	}
+}
+
+static int __init bench_init(void)
+{
+	struct input_dev *dev;
+	unsigned int s;
+	int error;
+
+	if (!sources || sources > SOURCES_MAX) {
+		printk(KERN_ERR "hotswap_bench.c: sources must be 1 to %d\n", SOURCES_MAX);
+		return -EINVAL;
+	}
+	keyboards = min(keyboards, sources);
+
+	bench_debugfs = debugfs_create_dir("hotswap_bench", NULL);
+	if (IS_ERR_OR_NULL(bench_debugfs)) {
+		printk(KERN_ERR "hotswap_bench.c: debugfs is needed for the results\n");
+		return -ENODEV;
+	}
+
+	error = input_register_handler(&bench_handler);
+	if (error) {
+		printk(KERN_ERR "hotswap_bench.c: Failed to register handler\n");
+		goto err_remove_debugfs;
+	}
+
+	// looks like a mouse to hotswap_ids, and to nothing else that is ours;
+	// the first ones have a left control key and are keyboards as well
+	for (s = 0; s < sources; s++) {
+		dev = input_allocate_device();
+		if (!dev) {
+			error = -ENOMEM;
+			goto err_free_devs;
+		}
+
+		dev->name = "hotswap_bench";
+		dev->id.bustype = BUS_VIRTUAL;
+		dev->evbit[0] = BIT_MASK(EV_SYN) | BIT_MASK(EV_KEY) | BIT_MASK(EV_REL) | BIT_MASK(EV_MSC);
+		dev->keybit[BIT_WORD(BTN_LEFT)] |= BIT_MASK(BTN_LEFT);
+		if (s < keyboards)
+			dev->keybit[BIT_WORD(KEY_LEFTCTRL)] |= BIT_MASK(KEY_LEFTCTRL);
+		dev->relbit[BIT_WORD(REL_X)] |= BIT_MASK(REL_X);
+		dev->relbit[BIT_WORD(REL_Y)] |= BIT_MASK(REL_Y);
+		dev->mscbit[BIT_WORD(MSC_SCAN)] |= BIT_MASK(MSC_SCAN);
+
+		error = input_register_device(dev);
+		if (error) {
+			input_free_device(dev);
+			goto err_free_devs;
+		}
+
+		bench_devs[s] = dev;
+	}
+
+	debugfs_create_file("run", 0200, bench_debugfs, NULL, &bench_run_fops);
+	debugfs_create_file("results", 0444, bench_debugfs, NULL, &bench_results_fops);
+
+	return 0;
+
+ err_free_devs:
+	printk(KERN_ERR "hotswap_bench.c: Failed to register the fake sources\n");
+	bench_free_devs(s);
+	input_unregister_handler(&bench_handler);
+ err_remove_debugfs:
+	debugfs_remove_recursive(bench_debugfs);
+	return error;
+}
+
+static void __exit bench_exit(void)
+{
+	debugfs_remove_recursive(bench_debugfs);
+
+	mutex_lock(&bench_mutex);
+	bench_stop();
+	mutex_unlock(&bench_mutex);
+
+	bench_free_devs(sources);
+	input_unregister_handler(&bench_handler);
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
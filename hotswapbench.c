@@ -0,0 +1,329 @@
+/*
+ * hotswapbench: measures what forwarding costs, with the hotswap kernel
+ * module or hotswapd, whichever provides tmouse at the time.
+ *
+ *   hotswapbench [-n frames] [-i interval] [-w window] [-p hotswapd pid]
+ *
+ * A fake mouse is created through uinput, frames are written into it and
+ * read back from tmouse. Each frame carries its sequence number in MSC_SCAN,
+ * which both forward unchanged, so every frame that comes out is matched to
+ * the time it went in. With the kernel module the forwarding happens inside
+ * our own write(), so its cost shows up as our system time; with hotswapd,
+ * give its pid to have its CPU time counted as well.
+ */
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define STAT_BUCKETS 12
+
+static int gFrames    = 10000;
+static long gInterval = 0;      /* us between frames, 0 sends as fast as they are taken */
+static int gWindow    = 1;      /* frames in flight when sending as fast as they are taken */
+static pid_t gDaemon  = 0;
+
+static const long statBounds[STAT_BUCKETS - 1] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000 };
+
+static long long monotonicUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * user plus system time of a process in milliseconds, -1 if unknown
+ */
+static long cpuTime(pid_t pid) {
+    char path[64], buf[1024], *p;
+    unsigned long utime, stime;
+    FILE *fp;
+    size_t len;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = 0;
+
+    /* skip past the command name, it may contain spaces */
+    p = strrchr(buf, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+
+    return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+static long ownCpuTime(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+}
+
+static int createSource(void) {
+    struct uinput_user_dev dev;
+    int fd;
+
+    fd = open("/dev/uinput", O_WRONLY);
+    if (fd == -1) fd = open("/dev/input/uinput", O_WRONLY);
+    if (fd == -1) {
+        fprintf(stderr, "hotswapbench: could not open uinput: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+    ioctl(fd, UI_SET_MSCBIT, MSC_SCAN);
+
+    memset(&dev, 0, sizeof(dev));
+    snprintf(dev.name, sizeof(dev.name), "hotswapbench");
+    dev.id.bustype = BUS_VIRTUAL;
+
+    if (write(fd, &dev, sizeof(dev)) != sizeof(dev) || ioctl(fd, UI_DEV_CREATE) == -1) {
+        fprintf(stderr, "hotswapbench: could not create the source: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int openTarget(void) {
+    char node[64], name[64];
+    int fd, i;
+
+    for (i = 0; i < 32; ++i) {
+        snprintf(node, sizeof(node), "/dev/input/event%d", i);
+
+        fd = open(node, O_RDONLY | O_NONBLOCK);
+        if (fd == -1) continue;
+
+        memset(name, 0, sizeof(name));
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) != -1 && strcmp(name, "tmouse") == 0) return fd;
+
+        close(fd);
+    }
+
+    fprintf(stderr, "hotswapbench: no tmouse, load the module or start hotswapd\n");
+
+    return -1;
+}
+
+static int sendFrame(int fd, int seq) {
+    struct input_event frame[4];
+
+    memset(frame, 0, sizeof(frame));
+    frame[0].type = EV_MSC; frame[0].code = MSC_SCAN;   frame[0].value = seq;
+    frame[1].type = EV_REL; frame[1].code = REL_X;      frame[1].value = 1;
+    frame[2].type = EV_REL; frame[2].code = REL_Y;      frame[2].value = 1;
+    frame[3].type = EV_SYN; frame[3].code = SYN_REPORT; frame[3].value = 0;
+
+    return write(fd, frame, sizeof(frame)) == sizeof(frame);
+}
+
+/**
+ * reads whatever tmouse has, returns the number of frames that completed.
+ * A frame that was already counted, as lost or otherwise, is not counted
+ * again when it turns up
+ */
+static int receive(int fd, const long long *sent, char *counted, unsigned long *hist, long long *sum, long long *max) {
+    struct input_event events[64];
+    static int seq = -1;
+    long long latency;
+    ssize_t len;
+    int i, b, done = 0;
+
+    while ((len = read(fd, events, sizeof(events))) > 0) {
+        for (i = 0; i < (int) (len / sizeof(events[0])); ++i) {
+            if (events[i].type == EV_MSC && events[i].code == MSC_SCAN) {
+                seq = events[i].value;
+            }
+            else if (events[i].type == EV_SYN && events[i].code == SYN_REPORT && seq >= 0 && seq < gFrames && !counted[seq]) {
+                counted[seq] = 1;
+                latency = monotonicUs() - sent[seq];
+
+                for (b = 0; b < STAT_BUCKETS - 1 && latency >= statBounds[b]; ++b);
+                hist[b]++;
+                *sum += latency;
+                if (latency > *max) *max = latency;
+
+                seq = -1;
+                done++;
+            }
+        }
+    }
+
+    return done;
+}
+
+static void printPercentile(const unsigned long *hist, unsigned long count, int pct) {
+    unsigned long seen = 0;
+    int b;
+
+    for (b = 0; b < STAT_BUCKETS - 1; ++b) {
+        seen += hist[b];
+        if (seen * 100 >= count * pct) {
+            printf("  p%d < %ld us", pct, statBounds[b]);
+            return;
+        }
+    }
+
+    printf("  p%d >= %ld us", pct, statBounds[STAT_BUCKETS - 2]);
+}
+
+static int parseOptions(int argc, char *argv[]) {
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "n:i:w:p:")) != -1) {
+        switch (option) {
+            case 'n': gFrames = atoi(optarg); break;
+            case 'i': gInterval = atol(optarg); break;
+            case 'w': gWindow = atoi(optarg); break;
+            case 'p': gDaemon = atoi(optarg); break;
+            default: return 0;
+        }
+    }
+
+    return gFrames > 0 && gWindow > 0;
+}
+
+static void usage() {
+    printf("hotswapbench [-n frames] [-i interval] [-w window] [-p hotswapd pid]\n");
+    printf("    -n  frames to send, the default is 10000\n");
+    printf("    -i  microseconds between frames, the default 0 sends the next as soon as one is back\n");
+    printf("    -w  with -i 0, frames sent ahead before waiting for one to come back, the default is 1\n");
+    printf("    -p  pid of hotswapd, to count its CPU time too\n");
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long hist[STAT_BUCKETS];
+    long long *sent, start, elapsed, sum = 0, max = 0, next;
+    long cpu, daemonCpu = -1;
+    struct pollfd pfd;
+    char *counted;
+    int src, dst, seq = 0, received = 0, lost = 0, oldest = 0, waiting, timeout;
+
+    if (!parseOptions(argc, argv)) {
+        usage();
+
+        return 1;
+    }
+
+    src = createSource();
+    if (src == -1) return 1;
+
+    /* give the module or hotswapd time to pick the source up */
+    sleep(1);
+
+    dst = openTarget();
+    if (dst == -1) {
+        ioctl(src, UI_DEV_DESTROY);
+        return 1;
+    }
+
+    sent    = calloc(gFrames, sizeof(*sent));
+    counted = calloc(gFrames, sizeof(*counted));
+    if (!sent || !counted) {
+        fprintf(stderr, "hotswapbench: out of memory for %d frames\n", gFrames);
+        free(sent);
+        free(counted);
+        close(dst);
+        ioctl(src, UI_DEV_DESTROY);
+        close(src);
+        return 1;
+    }
+
+    memset(hist, 0, sizeof(hist));
+
+    pfd.fd     = dst;
+    pfd.events = POLLIN;
+
+    cpu = ownCpuTime();
+    if (gDaemon) daemonCpu = cpuTime(gDaemon);
+    start = next = monotonicUs();
+
+    while (received + lost < gFrames) {
+        /* flooding keeps a window of frames in flight */
+        if (seq < gFrames && (gInterval ? monotonicUs() >= next : seq - received - lost < gWindow)) {
+            sent[seq] = monotonicUs();
+            if (!sendFrame(src, seq)) {
+                perror("hotswapbench: write");
+                break;
+            }
+            seq++;
+            next += gInterval;
+        }
+
+        /* only waiting for frames to come back, a second without one is a loss */
+        waiting = !gInterval || seq == gFrames;
+        timeout = waiting ? 1000 : (int) ((next - monotonicUs()) / 1000);
+        if (timeout < 0) timeout = 0;
+
+        /* everything still in flight after a second is taken as lost, it
+         * won't be counted should it turn up later */
+        if (poll(&pfd, 1, timeout) == 0 && waiting) {
+            if (gInterval) break;
+
+            for (; oldest < seq; ++oldest) {
+                if (counted[oldest]) continue;
+                counted[oldest] = 1;
+                lost++;
+            }
+        }
+
+        received += receive(dst, sent, counted, hist, &sum, &max);
+    }
+
+    /* with an interval, whatever didn't come back by the end is lost */
+    lost = seq - received;
+
+    elapsed = monotonicUs() - start;
+    cpu = ownCpuTime() - cpu;
+    if (daemonCpu >= 0) daemonCpu = cpuTime(gDaemon) - daemonCpu;
+
+    printf("hotswapbench: %d frames sent, %d forwarded, %d lost in %lld ms, %.0f frames/s\n",
+           seq, received, lost, elapsed / 1000, elapsed ? received * 1000000.0 / elapsed : 0.0);
+    if (received) {
+        printf("  latency avg %lld us max %lld us", sum / received, max);
+        printPercentile(hist, received, 50);
+        printPercentile(hist, received, 90);
+        printPercentile(hist, received, 99);
+        printf("\n");
+    }
+    printf("  cpu %ld ms here", cpu);
+    if (daemonCpu >= 0) printf(", %ld ms in hotswapd", daemonCpu);
+    printf(", %.1f us/frame\n", received ? (cpu + (daemonCpu > 0 ? daemonCpu : 0)) * 1000.0 / received : 0.0);
+
+    free(sent);
+    free(counted);
+    close(dst);
+    ioctl(src, UI_DEV_DESTROY);
+    close(src);
+
+    return 0;
+}
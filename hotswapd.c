@@ -0,0 +1,542 @@
+/*
+ * hotswapd: the hotswap kernel module in userspace, for kernels it can't be
+ * built against or when a crash in it shouldn't take the device down.
+ *
+ *   hotswapd [-v]
+ *
+ * It creates the same tkbd and tmouse virtual devices through uinput, finds
+ * sources by watching /dev/input with inotify, grabs them so nothing else
+ * sees their events twice and forwards whole frames: a source's events are
+ * read in batches and written out with one write() per frame and class.
+ * Sources are matched with the same rules as hotswap_ids in hotswap.c.
+ */
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
+#define INPUT_DIR   "/dev/input"
+#define SOURCE_SLOTS 32          /* the sources table starts out this big and doubles */
+#define INOTIFY_KEY  0xffffffffu /* epoll key of the inotify fd, sources are keyed by number */
+#define FRAME_MAX   64
+#define READ_BATCH  64
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NLONGS(bits)  (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define testBit(bit, array) (((array)[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+enum e_class {
+    classKeyboard,
+    classMouse,
+    classCount
+};
+
+/**
+ * a virtual device, the capabilities are those of the kernel module's
+ */
+struct device_class {
+    const char *name;
+    void (*setup)(int fd);
+    int fd;
+};
+
+/**
+ * a grabbed device, events are held back until its SYN_REPORT
+ */
+struct source {
+    int fd;
+    int number;             /* N of /dev/input/eventN */
+    unsigned classes;       /* bit per enum e_class */
+    int dropped;            /* skipping to the next report after SYN_DROPPED */
+    int count;
+    struct input_event frame[FRAME_MAX + 1];
+};
+
+static int gVerbose = 0;
+
+static volatile sig_atomic_t working = 0;
+
+static struct source **sources;   /* by N of /dev/input/eventN */
+static int sourceSlots = 0;
+
+static void setupKeyboard(int fd);
+static void setupMouse(int fd);
+
+static struct device_class classes[classCount] = {
+    [classKeyboard] = { "tkbd",   setupKeyboard, -1 },
+    [classMouse]    = { "tmouse", setupMouse,    -1 },
+};
+
+static void setBit(int fd, unsigned long request, int bit) {
+    if (ioctl(fd, request, bit) == -1) fprintf(stderr, "hotswapd: could not set capability %d: %s\n", bit, strerror(errno));
+}
+
+static void setupKeyboard(int fd) {
+    int k;
+
+    setBit(fd, UI_SET_EVBIT, EV_KEY);
+    setBit(fd, UI_SET_EVBIT, EV_MSC);
+    setBit(fd, UI_SET_EVBIT, EV_LED);
+    setBit(fd, UI_SET_EVBIT, EV_REP);
+
+    for (k = 1; k < KEY_MIN_INTERESTING; ++k) setBit(fd, UI_SET_KEYBIT, k);
+
+    setBit(fd, UI_SET_MSCBIT, MSC_SCAN);
+
+    setBit(fd, UI_SET_LEDBIT, LED_NUML);
+    setBit(fd, UI_SET_LEDBIT, LED_CAPSL);
+    setBit(fd, UI_SET_LEDBIT, LED_SCROLLL);
+}
+
+static void setupMouse(int fd) {
+    int b;
+
+    setBit(fd, UI_SET_EVBIT, EV_KEY);
+    setBit(fd, UI_SET_EVBIT, EV_REL);
+    setBit(fd, UI_SET_EVBIT, EV_MSC);
+
+    for (b = BTN_LEFT; b <= BTN_TASK; ++b) setBit(fd, UI_SET_KEYBIT, b);
+
+    setBit(fd, UI_SET_RELBIT, REL_X);
+    setBit(fd, UI_SET_RELBIT, REL_Y);
+    setBit(fd, UI_SET_RELBIT, REL_WHEEL);
+
+    setBit(fd, UI_SET_MSCBIT, MSC_SCAN);
+}
+
+static int createClass(struct device_class *cls) {
+    struct uinput_user_dev dev;
+    int fd;
+
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd == -1) fd = open("/dev/input/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd == -1) {
+        fprintf(stderr, "hotswapd: could not open uinput: %s\n", strerror(errno));
+        return 0;
+    }
+
+    cls->setup(fd);
+
+    memset(&dev, 0, sizeof(dev));
+    snprintf(dev.name, sizeof(dev.name), "%s", cls->name);
+    dev.id.bustype = 0x03;
+    dev.id.vendor  = 0x0;
+    dev.id.product = 0x03;
+    dev.id.version = 0x110;
+
+    if (write(fd, &dev, sizeof(dev)) != sizeof(dev) || ioctl(fd, UI_DEV_CREATE) == -1) {
+        fprintf(stderr, "hotswapd: could not create %s: %s\n", cls->name, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    cls->fd = fd;
+
+    return 1;
+}
+
+static void destroyClasses(void) {
+    int c;
+
+    for (c = 0; c < classCount; ++c) {
+        if (classes[c].fd == -1) continue;
+
+        ioctl(classes[c].fd, UI_DEV_DESTROY);
+        close(classes[c].fd);
+        classes[c].fd = -1;
+    }
+}
+
+/**
+ * the classes a device belongs to, hotswap_ids in hotswap.c: a keyboard
+ * has left ctrl, a mouse has a left button and two relative axes
+ */
+static unsigned matchClasses(int fd) {
+    unsigned long evbit[NLONGS(EV_CNT)], keybit[NLONGS(KEY_CNT)], relbit[NLONGS(REL_CNT)];
+    unsigned matched = 0;
+
+    memset(evbit, 0, sizeof(evbit));
+    memset(keybit, 0, sizeof(keybit));
+    memset(relbit, 0, sizeof(relbit));
+
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(evbit)), evbit) == -1) return 0;
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybit)), keybit);
+    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(relbit)), relbit);
+
+    if (testBit(EV_KEY, evbit) && testBit(KEY_LEFTCTRL, keybit)) {
+        matched |= 1 << classKeyboard;
+    }
+
+    if (testBit(EV_KEY, evbit) && testBit(EV_REL, evbit) && testBit(BTN_LEFT, keybit) &&
+        testBit(REL_X, relbit) && testBit(REL_Y, relbit)) {
+        matched |= 1 << classMouse;
+    }
+
+    return matched;
+}
+
+static int isVirtual(const char *name) {
+    int c;
+
+    for (c = 0; c < classCount; ++c) {
+        if (strcmp(name, classes[c].name) == 0) return 1;
+    }
+
+    return 0;
+}
+
+static void removeSource(int epfd, struct source *src) {
+    if (gVerbose) fprintf(stderr, "hotswapd: event%d is gone\n", src->number);
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    close(src->fd);
+
+    sources[src->number] = NULL;
+    free(src);
+}
+
+/**
+ * makes room in the sources table for eventN, returns 0 for failure
+ */
+static int growSources(int number) {
+    struct source **grown;
+    int slots = sourceSlots ? sourceSlots : SOURCE_SLOTS;
+
+    while (slots <= number && slots < (1 << 20)) slots *= 2;
+
+    grown = slots > number ? realloc(sources, slots * sizeof(*sources)) : NULL;
+    if (!grown) {
+        fprintf(stderr, "hotswapd: no room for event%d, it is not forwarded\n", number);
+        return 0;
+    }
+
+    memset(grown + sourceSlots, 0, (slots - sourceSlots) * sizeof(*grown));
+    sources     = grown;
+    sourceSlots = slots;
+
+    return 1;
+}
+
+/**
+ * opens /dev/input/eventN and adds it as a source if it belongs to a class,
+ * called again for a node that is already a source it does nothing
+ */
+static void addSource(int epfd, int number) {
+    char node[64], name[64];
+    struct epoll_event ev;
+    struct source *src;
+    unsigned matched;
+    int fd;
+
+    if (number < 0 || (number < sourceSlots && sources[number])) return;
+    if (number >= sourceSlots && !growSources(number)) return;
+
+    snprintf(node, sizeof(node), INPUT_DIR "/event%d", number);
+
+    /* udev may not have fixed the permissions yet, IN_ATTRIB brings us back */
+    fd = open(node, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) return;
+
+    memset(name, 0, sizeof(name));
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+
+    /* ours, or the kernel module's: binding to them would loop events back */
+    matched = isVirtual(name) ? 0 : matchClasses(fd);
+    if (!matched) {
+        close(fd);
+        return;
+    }
+
+    if (ioctl(fd, EVIOCGRAB, 1) == -1) {
+        fprintf(stderr, "hotswapd: could not grab %s (%s): %s\n", node, name, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    src = calloc(1, sizeof(*src));
+    if (!src) {
+        close(fd);
+        return;
+    }
+
+    src->fd      = fd;
+    src->number  = number;
+    src->classes = matched;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u32 = number;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("hotswapd: epoll_ctl");
+        close(fd);
+        free(src);
+        return;
+    }
+
+    sources[number] = src;
+
+    if (gVerbose) fprintf(stderr, "hotswapd: forwarding %s (%s)%s%s\n", node, name,
+                          matched & (1 << classKeyboard) ? " to tkbd" : "",
+                          matched & (1 << classMouse) ? " to tmouse" : "");
+}
+
+static int eventNumber(const char *name) {
+    char *end;
+    long n;
+
+    if (strncmp(name, "event", 5) != 0) return -1;
+
+    n = strtol(name + 5, &end, 10);
+
+    return (*end || end == name + 5) ? -1 : (int) n;
+}
+
+static void scanSources(int epfd) {
+    struct dirent *entry;
+    DIR *dir;
+
+    dir = opendir(INPUT_DIR);
+    if (!dir) {
+        perror("hotswapd: " INPUT_DIR);
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) addSource(epfd, eventNumber(entry->d_name));
+
+    closedir(dir);
+}
+
+static void watchSources(int epfd, int ifd) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ie;
+    ssize_t len;
+    char *p;
+    int number;
+
+    while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ie->len) {
+            ie = (const struct inotify_event *) p;
+            if (!ie->len) continue;
+
+            number = eventNumber(ie->name);
+            if (number < 0) continue;
+
+            if (ie->mask & IN_DELETE) {
+                /* normally a read has already failed with ENODEV */
+                if (number < sourceSlots && sources[number]) removeSource(epfd, sources[number]);
+            }
+            else {
+                addSource(epfd, number);
+            }
+        }
+    }
+}
+
+/**
+ * writes the buffered frame to every class of the source, SYN_REPORT and all
+ */
+static void forwardFrame(struct source *src) {
+    size_t size;
+    int c;
+
+    size = (src->count + 1) * sizeof(struct input_event);
+
+    for (c = 0; c < classCount; ++c) {
+        if (!(src->classes & (1 << c)) || classes[c].fd == -1) continue;
+
+        if (write(classes[c].fd, src->frame, size) != (ssize_t) size && gVerbose) {
+            fprintf(stderr, "hotswapd: lost a frame to %s: %s\n", classes[c].name, strerror(errno));
+        }
+    }
+}
+
+static void feedSource(struct source *src, const struct input_event *ev) {
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+        /* the rest of this frame is lost, don't forward half of it */
+        src->count   = 0;
+        src->dropped = 1;
+        return;
+    }
+
+    if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        if (!src->dropped) {
+            src->frame[src->count] = *ev;
+            forwardFrame(src);
+        }
+
+        src->count   = 0;
+        src->dropped = 0;
+        return;
+    }
+
+    if (src->dropped) return;
+
+    /* an overlong frame goes out in pieces rather than losing events */
+    if (src->count == FRAME_MAX) {
+        memset(&src->frame[src->count], 0, sizeof(struct input_event));
+        src->frame[src->count].type = EV_SYN;
+        src->frame[src->count].code = SYN_REPORT;
+        forwardFrame(src);
+        src->count = 0;
+    }
+
+    src->frame[src->count++] = *ev;
+}
+
+/**
+ * drains a source, returns 0 once the device is gone
+ */
+static int readSource(struct source *src) {
+    struct input_event events[READ_BATCH];
+    ssize_t len;
+    int i, n;
+
+    for (;;) {
+        len = read(src->fd, events, sizeof(events));
+
+        if (len == -1) return errno == EAGAIN || errno == EINTR;
+        if (len == 0) return 0;
+
+        n = len / sizeof(struct input_event);
+        for (i = 0; i < n; ++i) feedSource(src, &events[i]);
+
+        if (n < READ_BATCH) return 1;
+    }
+}
+
+static void forward(int epfd, int ifd) {
+    struct epoll_event events[16];
+    struct source *src;
+    int i, n, changed;
+
+    while (working) {
+        n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+
+            perror("hotswapd: epoll_wait");
+            break;
+        }
+
+        /* sources are looked up by number, and added or removed only
+         * once the batch is through, so an event later in the batch
+         * never finds a source freed under it */
+        changed = 0;
+        for (i = 0; i < n; ++i) {
+            if (events[i].data.u32 == INOTIFY_KEY) {
+                changed = 1;
+                continue;
+            }
+
+            src = sources[events[i].data.u32];
+            if (!src) continue;
+
+            if (!readSource(src) || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                removeSource(epfd, src);
+            }
+        }
+
+        if (changed) watchSources(epfd, ifd);
+    }
+}
+
+static void signalHandler(int sig) {
+    working = 0;
+}
+
+static int parseOptions(int argc, char *argv[]) {
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "v")) != -1) {
+        switch (option) {
+            case 'v': gVerbose = 1; break;
+            default: return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void usage() {
+    printf("hotswapd [-v]\n");
+    printf("    -v  report sources as they come and go\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct epoll_event ev;
+    struct sigaction sa;
+    int epfd, ifd, c, i;
+
+    if (!parseOptions(argc, argv)) {
+        usage();
+
+        return 1;
+    }
+
+    for (c = 0; c < classCount; ++c) {
+        if (!createClass(&classes[c])) {
+            destroyClasses();
+            return 1;
+        }
+    }
+
+    epfd = epoll_create(1);
+    if (epfd == -1) {
+        perror("hotswapd: epoll_create");
+        destroyClasses();
+        return 1;
+    }
+
+    /* watch before scanning so nothing plugged in between is missed */
+    ifd = inotify_init1(IN_NONBLOCK);
+    if (ifd == -1 || inotify_add_watch(ifd, INPUT_DIR, IN_CREATE | IN_ATTRIB | IN_DELETE) == -1) {
+        perror("hotswapd: inotify");
+        destroyClasses();
+        return 1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u32 = INOTIFY_KEY;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ifd, &ev);
+
+    scanSources(epfd);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signalHandler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    working = 1;
+    forward(epfd, ifd);
+
+    for (i = 0; i < sourceSlots; ++i) {
+        if (sources[i]) removeSource(epfd, sources[i]);
+    }
+    free(sources);
+
+    close(ifd);
+    close(epfd);
+    destroyClasses();
+
+    return 0;
+}
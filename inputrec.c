@@ -0,0 +1,675 @@
+/*
+ * inputrec: records evdev streams and plays them back through uinput, for
+ * load tests of the hotswap module, hotswapd and pointer that can be repeated.
+ *
+ *   inputrec -o file [-g] device...     record until interrupted
+ *   inputrec -p file [-s speed] [-v]    replay, speed 0 is as fast as possible
+ *
+ * A recording starts with the devices it was taken from, so the player can
+ * create them again with the same capabilities:
+ *
+ *   "HSWR" version:u8 sources:u8
+ *   per source: length:u8 name, the EV, KEY, REL, ABS, MSC and LED bitmaps,
+ *               min:s32 max:s32 of every ABS axis it has
+ *
+ * followed by one record per event:
+ *
+ *   time since the previous one in us:varint, source << 5 | type:u8,
+ *   code:varint, value:zigzag varint
+ *
+ * which is 4 bytes for most events instead of the 16 or 24 of struct
+ * input_event. SYN_REPORT is recorded like any other event, the player writes
+ * a source's frame at once when it gets there.
+ *
+ * While playing, tkbd and tmouse are read back and every frame they send is
+ * matched to the oldest outstanding one played into them, which gives the
+ * forwarding latency. That only adds up with max_rate=0, coalescing makes
+ * fewer frames come out than went in.
+ */
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MAGIC        "HSWR"
+#define VERSION      1
+#define MAX_SOURCES  8          /* what fits in the 3 bits of a record */
+#define FRAME_MAX    64
+#define PENDING_MAX  1024       /* frames in flight per class */
+#define STAT_BUCKETS 12
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NLONGS(bits)  (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define testBit(bit, array) (((array)[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+#define testByteBit(bit, bytes) (((bytes)[(bit) / 8] >> ((bit) % 8)) & 1)
+
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
+/**
+ * the capability bitmaps kept for every source, as bytes so a recording
+ * reads the same on any machine
+ */
+enum e_cap { capEv, capKey, capRel, capAbs, capMsc, capLed, capCount };
+
+static const int capType[capCount] = { 0, EV_KEY, EV_REL, EV_ABS, EV_MSC, EV_LED };
+static const int capBits[capCount] = { EV_CNT, KEY_CNT, REL_CNT, ABS_CNT, MSC_CNT, LED_CNT };
+
+struct source {
+    char name[UINPUT_MAX_NAME_SIZE];
+    uint8_t caps[capCount][(KEY_CNT + 7) / 8];
+    int32_t absmin[ABS_CNT], absmax[ABS_CNT];
+    int fd;
+    int count;
+    struct input_event frame[FRAME_MAX + 1];
+};
+
+enum e_class { classKeyboard, classMouse, classCount };
+
+/**
+ * a virtual device read back while playing, with the times the frames
+ * played into it were written
+ */
+struct target {
+    const char *name;
+    int fd;
+    long long pending[PENDING_MAX];
+    unsigned head, tail;
+    int inFrame;            /* the frame being read has something besides repeats */
+    unsigned long frames;
+    unsigned long hist[STAT_BUCKETS];
+    long long sum, max;
+};
+
+static const char *gOutput = NULL;
+static const char *gInput  = NULL;
+static double gSpeed       = 1.0;
+static int gGrab           = 0;
+static int gVerbose        = 0;
+
+static volatile sig_atomic_t working = 0;
+
+static struct source sources[MAX_SOURCES];
+static int sourceCount = 0;
+
+static struct target targets[classCount] = {
+    [classKeyboard] = { "tkbd", -1 },
+    [classMouse]    = { "tmouse", -1 },
+};
+
+static const long statBounds[STAT_BUCKETS - 1] = { 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+
+static long long monotonicUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void signalHandler(int sig) {
+    working = 0;
+}
+
+static void putVarint(FILE *fp, uint32_t v) {
+    while (v >= 0x80) {
+        fputc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    fputc(v, fp);
+}
+
+static int getVarint(FILE *fp, uint32_t *v) {
+    int c, shift = 0;
+
+    *v = 0;
+    do {
+        if ((c = fgetc(fp)) == EOF || shift > 28) return 0;
+        *v |= (uint32_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 1;
+}
+
+static void put32(FILE *fp, int32_t v) {
+    uint32_t u = v;
+
+    fputc(u, fp); fputc(u >> 8, fp); fputc(u >> 16, fp); fputc(u >> 24, fp);
+}
+
+static int get32(FILE *fp, int32_t *v) {
+    uint8_t b[4];
+
+    if (fread(b, 1, 4, fp) != 4) return 0;
+    *v = (int32_t) (b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24);
+
+    return 1;
+}
+
+static void writeHeader(FILE *fp) {
+    struct source *src;
+    int s, c, a;
+    size_t len;
+
+    fwrite(MAGIC, 1, 4, fp);
+    fputc(VERSION, fp);
+    fputc(sourceCount, fp);
+
+    for (s = 0; s < sourceCount; ++s) {
+        src = &sources[s];
+        len = strlen(src->name);
+
+        fputc(len, fp);
+        fwrite(src->name, 1, len, fp);
+        for (c = 0; c < capCount; ++c) fwrite(src->caps[c], 1, (capBits[c] + 7) / 8, fp);
+        for (a = 0; a < ABS_CNT; ++a) {
+            if (!testByteBit(a, src->caps[capAbs])) continue;
+            put32(fp, src->absmin[a]);
+            put32(fp, src->absmax[a]);
+        }
+    }
+}
+
+static int readHeader(FILE *fp) {
+    char magic[4];
+    struct source *src;
+    int s, c, a, len;
+
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, MAGIC, 4) != 0 || fgetc(fp) != VERSION) {
+        fprintf(stderr, "inputrec: %s is not a recording\n", gInput);
+        return 0;
+    }
+
+    sourceCount = fgetc(fp);
+    if (sourceCount <= 0 || sourceCount > MAX_SOURCES) return 0;
+
+    for (s = 0; s < sourceCount; ++s) {
+        src = &sources[s];
+        memset(src, 0, sizeof(*src));
+        src->fd = -1;
+
+        len = fgetc(fp);
+        if (len == EOF || len >= (int) sizeof(src->name) || fread(src->name, 1, len, fp) != (size_t) len) return 0;
+
+        for (c = 0; c < capCount; ++c) {
+            if (fread(src->caps[c], 1, (capBits[c] + 7) / 8, fp) != (size_t) (capBits[c] + 7) / 8) return 0;
+        }
+        for (a = 0; a < ABS_CNT; ++a) {
+            if (!testByteBit(a, src->caps[capAbs])) continue;
+            if (!get32(fp, &src->absmin[a]) || !get32(fp, &src->absmax[a])) return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void writeRecord(FILE *fp, int s, uint32_t dt, const struct input_event *ev) {
+    putVarint(fp, dt);
+    fputc(s << 5 | (ev->type & 0x1f), fp);
+    putVarint(fp, ev->code);
+    putVarint(fp, ((uint32_t) ev->value << 1) ^ (uint32_t) (ev->value >> 31));
+}
+
+static int readRecord(FILE *fp, int *s, uint32_t *dt, struct input_event *ev) {
+    uint32_t code, value;
+    int c;
+
+    if (!getVarint(fp, dt) || (c = fgetc(fp)) == EOF || !getVarint(fp, &code) || !getVarint(fp, &value)) return 0;
+
+    memset(ev, 0, sizeof(*ev));
+    *s        = c >> 5;
+    ev->type  = c & 0x1f;
+    ev->code  = code;
+    ev->value = (int32_t) ((value >> 1) ^ -(value & 1));
+
+    return *s < sourceCount;
+}
+
+
+static int openSource(const char *path, struct source *src) {
+    unsigned long bits[NLONGS(KEY_CNT)];
+    struct input_absinfo abs;
+    int c, b;
+
+    memset(src, 0, sizeof(*src));
+
+    src->fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (src->fd == -1) {
+        fprintf(stderr, "inputrec: could not open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    ioctl(src->fd, EVIOCGNAME(sizeof(src->name) - 1), src->name);
+
+    for (c = 0; c < capCount; ++c) {
+        memset(bits, 0, sizeof(bits));
+        ioctl(src->fd, EVIOCGBIT(capType[c], sizeof(bits)), bits);
+
+        for (b = 0; b < capBits[c]; ++b) {
+            if (testBit(b, bits)) src->caps[c][b / 8] |= 1 << (b % 8);
+        }
+    }
+
+    for (b = 0; b < ABS_CNT; ++b) {
+        if (!testByteBit(b, src->caps[capAbs]) || ioctl(src->fd, EVIOCGABS(b), &abs) == -1) continue;
+        src->absmin[b] = abs.minimum;
+        src->absmax[b] = abs.maximum;
+    }
+
+    if (gGrab && ioctl(src->fd, EVIOCGRAB, 1) == -1) {
+        fprintf(stderr, "inputrec: could not grab %s: %s\n", path, strerror(errno));
+    }
+
+    return 1;
+}
+
+static int record(int argc, char *argv[]) {
+    struct pollfd pfds[MAX_SOURCES];
+    struct input_event events[64];
+    long long last = -1, now;
+    unsigned long count = 0;
+    ssize_t len;
+    FILE *fp;
+    int s, i, n;
+
+    for (i = 0; i < argc && sourceCount < MAX_SOURCES; ++i) {
+        if (!openSource(argv[i], &sources[sourceCount])) return 1;
+
+        pfds[sourceCount].fd     = sources[sourceCount].fd;
+        pfds[sourceCount].events = POLLIN;
+        sourceCount++;
+    }
+
+    if (!sourceCount) {
+        fprintf(stderr, "inputrec: nothing to record from\n");
+        return 1;
+    }
+
+    fp = strcmp(gOutput, "-") == 0 ? stdout : fopen(gOutput, "wb");
+    if (!fp) {
+        fprintf(stderr, "inputrec: could not create %s: %s\n", gOutput, strerror(errno));
+        return 1;
+    }
+
+    writeHeader(fp);
+
+    if (gVerbose) fprintf(stderr, "inputrec: recording %d devices, interrupt to stop\n", sourceCount);
+
+    while (working) {
+        if (poll(pfds, sourceCount, -1) == -1) {
+            if (errno == EINTR) continue;
+
+            perror("inputrec: poll");
+            break;
+        }
+
+        for (s = 0; s < sourceCount; ++s) {
+            if (!(pfds[s].revents & POLLIN)) continue;
+
+            while ((len = read(sources[s].fd, events, sizeof(events))) > 0) {
+                n = len / sizeof(events[0]);
+
+                for (i = 0; i < n; ++i) {
+                    if (events[i].type == EV_SYN && events[i].code == SYN_DROPPED) continue;
+
+                    /* devices are only read in turn, don't let time go backwards */
+                    now = (long long) events[i].time.tv_sec * 1000000 + events[i].time.tv_usec;
+                    if (last < 0 || now < last) last = now;
+
+                    writeRecord(fp, s, (uint32_t) (now - last), &events[i]);
+                    last = now;
+                    count++;
+                }
+            }
+        }
+    }
+
+    if (fp != stdout) fclose(fp);
+    else fflush(fp);
+
+    for (s = 0; s < sourceCount; ++s) close(sources[s].fd);
+
+    if (gVerbose) fprintf(stderr, "inputrec: recorded %lu events\n", count);
+
+    return 0;
+}
+
+static int createSource(struct source *src) {
+    struct uinput_user_dev dev;
+    int c, b;
+
+    src->fd = open("/dev/uinput", O_WRONLY);
+    if (src->fd == -1) src->fd = open("/dev/input/uinput", O_WRONLY);
+    if (src->fd == -1) {
+        fprintf(stderr, "inputrec: could not open uinput: %s\n", strerror(errno));
+        return 0;
+    }
+
+    memset(&dev, 0, sizeof(dev));
+
+    /* the recording has the repeats the device made, the kernel's own
+     * autorepeat would add its repeats on top of them */
+    for (b = 0; b < EV_CNT; ++b) {
+        if (b != EV_REP && testByteBit(b, src->caps[capEv])) ioctl(src->fd, UI_SET_EVBIT, b);
+    }
+
+    for (c = capKey; c < capCount; ++c) {
+        static const unsigned long request[capCount] = { 0, UI_SET_KEYBIT, UI_SET_RELBIT, UI_SET_ABSBIT, UI_SET_MSCBIT, UI_SET_LEDBIT };
+
+        for (b = 0; b < capBits[c]; ++b) {
+            if (testByteBit(b, src->caps[c])) ioctl(src->fd, request[c], b);
+        }
+    }
+
+    for (b = 0; b < ABS_CNT; ++b) {
+        dev.absmin[b] = src->absmin[b];
+        dev.absmax[b] = src->absmax[b];
+    }
+
+    /* not the original name, hotswapd and the module skip tkbd and tmouse */
+    snprintf(dev.name, sizeof(dev.name), "replay %.*s", (int) sizeof(dev.name) - 8, src->name);
+    dev.id.bustype = BUS_VIRTUAL;
+
+    if (write(src->fd, &dev, sizeof(dev)) != sizeof(dev) || ioctl(src->fd, UI_DEV_CREATE) == -1) {
+        fprintf(stderr, "inputrec: could not create %s: %s\n", dev.name, strerror(errno));
+        close(src->fd);
+        src->fd = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void openTargets(void) {
+    char node[64], name[64];
+    int fd, i, c;
+
+    for (i = 0; i < 32; ++i) {
+        snprintf(node, sizeof(node), "/dev/input/event%d", i);
+
+        fd = open(node, O_RDONLY | O_NONBLOCK);
+        if (fd == -1) continue;
+
+        memset(name, 0, sizeof(name));
+        ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+
+        for (c = 0; c < classCount; ++c) {
+            if (targets[c].fd == -1 && strcmp(name, targets[c].name) == 0) break;
+        }
+
+        if (c < classCount) targets[c].fd = fd;
+        else close(fd);
+    }
+}
+
+/**
+ * whether the class forwards the event, the capabilities of tkbd and tmouse
+ * in hotswap.c; key repeats are left out on both sides, tkbd makes its own
+ */
+static int classTakes(int c, const struct input_event *ev) {
+    if (ev->type == EV_KEY && ev->value == 2) return 0;
+
+    if (c == classKeyboard) return ev->type == EV_KEY && ev->code > 0 && ev->code < KEY_MIN_INTERESTING;
+
+    return (ev->type == EV_KEY && ev->code >= BTN_LEFT && ev->code <= BTN_TASK) ||
+           (ev->type == EV_REL && (ev->code == REL_X || ev->code == REL_Y || ev->code == REL_WHEEL));
+}
+
+/**
+ * the classes hotswap_ids in hotswap.c puts a source in
+ */
+static int sourceClass(const struct source *src, int c) {
+    if (!testByteBit(EV_KEY, src->caps[capEv])) return 0;
+
+    if (c == classKeyboard) return testByteBit(KEY_LEFTCTRL, src->caps[capKey]);
+
+    return testByteBit(EV_REL, src->caps[capEv]) && testByteBit(BTN_LEFT, src->caps[capKey]) &&
+           testByteBit(REL_X, src->caps[capRel]) && testByteBit(REL_Y, src->caps[capRel]);
+}
+
+static void writeFrame(struct source *src) {
+    size_t size = (src->count + 1) * sizeof(struct input_event);
+    struct target *t;
+    long long now;
+    int c, i;
+
+    now = monotonicUs();
+    if (write(src->fd, src->frame, size) != (ssize_t) size) perror("inputrec: write");
+
+    for (c = 0; c < classCount; ++c) {
+        t = &targets[c];
+        if (t->fd == -1 || !sourceClass(src, c)) continue;
+
+        for (i = 0; i < src->count && !classTakes(c, &src->frame[i]); ++i);
+        if (i == src->count || t->tail - t->head == PENDING_MAX) continue;
+
+        t->pending[t->tail++ % PENDING_MAX] = now;
+    }
+}
+
+static void readTargets(int timeout) {
+    struct pollfd pfds[classCount];
+    struct input_event events[64];
+    struct target *t;
+    long long latency;
+    ssize_t len;
+    int c, i, b, n = 0;
+
+    for (c = 0; c < classCount; ++c) {
+        if (targets[c].fd == -1) continue;
+        pfds[n].fd     = targets[c].fd;
+        pfds[n].events = POLLIN;
+        n++;
+    }
+
+    if (!n) {
+        if (timeout > 0) poll(NULL, 0, timeout);
+        return;
+    }
+
+    if (poll(pfds, n, timeout) <= 0) return;
+
+    for (c = 0; c < classCount; ++c) {
+        t = &targets[c];
+        if (t->fd == -1) continue;
+
+        while ((len = read(t->fd, events, sizeof(events))) > 0) {
+            for (i = 0; i < (int) (len / sizeof(events[0])); ++i) {
+                if (events[i].type != EV_SYN) {
+                    if (classTakes(c, &events[i])) t->inFrame = 1;
+                    continue;
+                }
+
+                if (events[i].code != SYN_REPORT || !t->inFrame) continue;
+                t->inFrame = 0;
+
+                if (t->head == t->tail) continue;
+
+                latency = monotonicUs() - t->pending[t->head++ % PENDING_MAX];
+                for (b = 0; b < STAT_BUCKETS - 1 && latency >= statBounds[b]; ++b);
+                t->hist[b]++;
+                t->frames++;
+                t->sum += latency;
+                if (latency > t->max) t->max = latency;
+            }
+        }
+    }
+}
+
+static void printPercentile(const struct target *t, int pct) {
+    unsigned long seen = 0;
+    int b;
+
+    for (b = 0; b < STAT_BUCKETS - 1; ++b) {
+        seen += t->hist[b];
+        if (seen * 100 >= t->frames * pct) {
+            printf("  p%d < %ld us", pct, statBounds[b]);
+            return;
+        }
+    }
+
+    printf("  p%d >= %ld us", pct, statBounds[STAT_BUCKETS - 2]);
+}
+
+static int play(void) {
+    struct input_event ev;
+    struct source *src;
+    struct target *t;
+    long long start, due, now, elapsed;
+    unsigned long long at = 0;
+    unsigned long count = 0;
+    uint32_t dt;
+    FILE *fp;
+    int s, c, wait;
+
+    fp = strcmp(gInput, "-") == 0 ? stdin : fopen(gInput, "rb");
+    if (!fp) {
+        fprintf(stderr, "inputrec: could not open %s: %s\n", gInput, strerror(errno));
+        return 1;
+    }
+
+    if (!readHeader(fp)) {
+        fprintf(stderr, "inputrec: %s is damaged\n", gInput);
+        return 1;
+    }
+
+    for (s = 0; s < sourceCount; ++s) {
+        if (!createSource(&sources[s])) return 1;
+    }
+
+    /* give the module or hotswapd time to pick them up */
+    sleep(1);
+    openTargets();
+
+    start = monotonicUs();
+
+    while (working && readRecord(fp, &s, &dt, &ev)) {
+        at += dt;
+
+        if (gSpeed > 0) {
+            due = start + (long long) (at / gSpeed);
+
+            while ((now = monotonicUs()) < due) {
+                wait = (int) ((due - now) / 1000);
+                readTargets(wait);
+                if (!wait) break;
+            }
+        }
+
+        src = &sources[s];
+        src->frame[src->count++] = ev;
+        count++;
+
+        if ((ev.type == EV_SYN && ev.code == SYN_REPORT) || src->count == FRAME_MAX) {
+            if (ev.type != EV_SYN) {
+                memset(&src->frame[src->count], 0, sizeof(ev));
+                src->frame[src->count].type = EV_SYN;
+                src->frame[src->count].code = SYN_REPORT;
+            }
+            else {
+                src->count--;
+            }
+
+            writeFrame(src);
+            src->count = 0;
+
+            if (gSpeed <= 0) readTargets(0);
+        }
+    }
+
+    elapsed = monotonicUs() - start;
+
+    /* what is still on its way */
+    readTargets(500);
+
+    if (fp != stdin) fclose(fp);
+
+    printf("inputrec: played %lu events in %lld ms, %.0f events/s\n",
+           count, elapsed / 1000, elapsed ? count * 1000000.0 / elapsed : 0.0);
+
+    for (c = 0; c < classCount; ++c) {
+        t = &targets[c];
+        if (t->fd == -1) continue;
+
+        printf("  %-6s %lu frames back, %u lost", t->name, t->frames, t->tail - t->head);
+        if (t->frames) {
+            printf(", latency avg %lld us max %lld us", t->sum / (long long) t->frames, t->max);
+            printPercentile(t, 50);
+            printPercentile(t, 90);
+            printPercentile(t, 99);
+        }
+        printf("\n");
+
+        close(t->fd);
+    }
+
+    for (s = 0; s < sourceCount; ++s) {
+        ioctl(sources[s].fd, UI_DEV_DESTROY);
+        close(sources[s].fd);
+    }
+
+    return 0;
+}
+
+static int parseOptions(int argc, char *argv[]) {
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "o:p:s:gv")) != -1) {
+        switch (option) {
+            case 'o': gOutput = optarg; break;
+            case 'p': gInput = optarg; break;
+            case 's': gSpeed = atof(optarg); break;
+            case 'g': gGrab = 1; break;
+            case 'v': gVerbose = 1; break;
+            default: return 0;
+        }
+    }
+
+    return (gOutput != NULL) != (gInput != NULL);
+}
+
+static void usage() {
+    printf("inputrec -o file [-g] device...\n");
+    printf("inputrec -p file [-s speed] [-v]\n");
+    printf("    -o  record the devices into file until interrupted, - is stdout\n");
+    printf("    -g  grab the devices while recording\n");
+    printf("    -p  play file back through uinput, - is stdin\n");
+    printf("    -s  speed to play at, 2 is twice as fast, 0 as fast as possible\n");
+    printf("    -v  verbose\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sa;
+
+    if (!parseOptions(argc, argv)) {
+        usage();
+
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signalHandler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    working = 1;
+
+    return gOutput ? record(argc - optind, argv + optind) : play();
+}
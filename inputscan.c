@@ -0,0 +1,124 @@
+/*
+ * inputscan: lists the event devices for makexconfig in one pass, instead of
+ * it running evtest, grep, awk and sed for every node, twice.
+ *
+ *   inputscan [directory]
+ *
+ * One line per /dev/input/event* in the order the shell would glob them:
+ *
+ *   /dev/input/event3 0003:0000:0003:0110 km tmouse
+ *
+ * node, bus:vendor:product:version in hex, what it looks like (k keyboard,
+ * m mouse, t touch screen, - none of them) and the name, which is last since
+ * it may contain spaces. Nodes that can't be opened or aren't evdev devices
+ * are left out.
+ */
+
+#include <linux/input.h>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NLONGS(bits)  (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define testBit(bit, array) (((array)[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+/**
+ * k, m and t as in hotswap_ids of hotswap.c, plus absolute touch screens
+ */
+static void classify(int fd, char *classes) {
+    unsigned long evbit[NLONGS(EV_CNT)], keybit[NLONGS(KEY_CNT)];
+    unsigned long relbit[NLONGS(REL_CNT)], absbit[NLONGS(ABS_CNT)];
+    char *p = classes;
+
+    memset(evbit, 0, sizeof(evbit));
+    memset(keybit, 0, sizeof(keybit));
+    memset(relbit, 0, sizeof(relbit));
+    memset(absbit, 0, sizeof(absbit));
+
+    ioctl(fd, EVIOCGBIT(0, sizeof(evbit)), evbit);
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybit)), keybit);
+    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(relbit)), relbit);
+    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbit)), absbit);
+
+    if (testBit(EV_KEY, evbit) && testBit(KEY_LEFTCTRL, keybit)) *p++ = 'k';
+
+    if (testBit(EV_KEY, evbit) && testBit(EV_REL, evbit) && testBit(BTN_LEFT, keybit) &&
+        testBit(REL_X, relbit) && testBit(REL_Y, relbit)) {
+        *p++ = 'm';
+    }
+
+    if (testBit(EV_ABS, evbit) &&
+        ((testBit(ABS_X, absbit) && testBit(ABS_Y, absbit)) ||
+         (testBit(ABS_MT_POSITION_X, absbit) && testBit(ABS_MT_POSITION_Y, absbit)))) {
+        *p++ = 't';
+    }
+
+    if (p == classes) *p++ = '-';
+    *p = 0;
+}
+
+static void scan(const char *dir, const char *entry) {
+    struct input_id id;
+    char node[256], name[256], classes[4];
+    char *c;
+    int fd;
+
+    snprintf(node, sizeof(node), "%s/%s", dir, entry);
+
+    fd = open(node, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) return;
+
+    memset(&id, 0, sizeof(id));
+    memset(name, 0, sizeof(name));
+    if (ioctl(fd, EVIOCGID, &id) == -1) {
+        close(fd);
+        return;
+    }
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+    classify(fd, classes);
+
+    close(fd);
+
+    /* keep it one line per device whatever the driver called it */
+    for (c = name; *c; ++c) {
+        if (*c == '\n' || *c == '\t') *c = ' ';
+    }
+
+    printf("%s %04x:%04x:%04x:%04x %s %s\n", node, id.bustype, id.vendor, id.product, id.version,
+           classes, name[0] ? name : "unknown");
+}
+
+static int isEventNode(const struct dirent *entry) {
+    return strncmp(entry->d_name, "event", 5) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : "/dev/input";
+    struct dirent **entries;
+    int i, n;
+
+    /* alphasort is what the shell's glob order comes down to */
+    n = scandir(dir, &entries, isEventNode, alphasort);
+    if (n == -1) {
+        perror("inputscan");
+        return 1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        scan(dir, entries[i]->d_name);
+        free(entries[i]);
+    }
+
+    free(entries);
+
+    return 0;
+}
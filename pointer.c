@@ -27,14 +27,39 @@
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
+#ifdef HAVE_XI2
+#include <X11/extensions/XInput2.h>
+#endif
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+#ifdef HAVE_XFIXES
+#include <X11/extensions/Xfixes.h>
+#endif
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#endif
 
 #include <errno.h>
 #include <X11/Xos.h>
 #include <X11/Xutil.h>
+#include <X11/cursorfont.h>
 #include <ctype.h>
 
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/fb.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <signal.h>
 #include <time.h>
@@ -43,19 +68,219 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
 
-static int gIdleTimeout = 1;
+static long gFrameInterval = 200;   /* milliseconds between refreshes */
+static int gRefreshSize = 100;
+static int gAlign       = 8;
+static int gMaxRects    = 4;
 static int gVerbose     = 0;
 
+static const char *gBackend = "x";
+static const char *gDevice  = NULL;
+static const char *gCursorFont = NULL;
+static const char *gEventDevice = NULL;
+static const char *gStatsFile = NULL;
+static long gStatsPeriod = 10;     /* seconds between writes of the stats file */
+static int gGhostLimit  = 0;       /* fast updates a tile takes before it is cleaned, 0 for none */
+static long gGhostIdle  = 1000;    /* milliseconds of rest before the cleanup */
+static long gPredictLead = 0;      /* milliseconds a refresh takes to show, 0 for no prediction */
+static long gDamageInterval = 0;   /* least milliseconds between refreshes of what other clients draw, 0 to leave it */
+
+/* how pointer.c learns about pointer activity */
+enum e_input {inputGrab, inputXI2, inputEvdev};
+
+static enum e_input gInput = inputGrab;
+
 static volatile sig_atomic_t working;
+static volatile sig_atomic_t dumpStats;
 
 static void signalHandler(int signo) {
     working = 0;
 }
 
+static void statsSignalHandler(int signo) {
+    dumpStats = 1;
+}
+
 enum e_action {doDefault, doBlack, doWhite, doSolid, doNone, doRoot};
 
-int xrefresh(Display *dpy, char *ProgramName, char *displayname, char *geom, enum e_action action, char *solidcolor);
+struct rect {
+    int x, y;
+    int width, height;
+};
+
+#define MAX_DIRTY 16
+
+/**
+ * The area that needs refreshing this frame, kept as a short list of
+ * non-overlapping-ish rectangles. Every rectangle is snapped outwards to
+ * the panel alignment and clipped to the screen on the way in, touching
+ * rectangles are merged as long as that does not refresh more pixels than
+ * keeping them apart, and beyond max rectangles everything collapses into
+ * one bounding box.
+ */
+struct dirty_region {
+    struct rect rects[MAX_DIRTY];
+    int count;
+    int align;
+    int max;
+    int screen_width, screen_height;
+};
+
+#define TILE_SIZE 64
+
+/**
+ * The ghosting left behind by fast updates. The screen is cut into tiles
+ * that count the partial updates they took since they were last cleaned
+ * with a full quality one. Tiles are cleaned once the pointer has been at
+ * rest for a while, or as soon as one has taken too many.
+ */
+struct ghost_map {
+    unsigned char *tiles;
+    struct rect *rects;    /* what ghostCollect() found, room for every tile */
+    int cols, rows;
+    int screen_width, screen_height;
+    int pending;           /* tiles with a count */
+    int over;              /* tiles at the limit */
+    int limit;             /* 0 when there is no cleaning up */
+    long idle;
+    struct timespec last;  /* of the last partial update */
+};
+
+#define MOTION_SAMPLES 3
+
+struct motion_sample {
+    int x, y;
+    long long us;
+};
+
+/**
+ * The last few pointer positions with the time they were seen, newest
+ * first, to guess where the pointer will be by the time a refresh shows on
+ * the panel. The guess is kept until the next position comes in so it can
+ * be checked against where the pointer really went.
+ */
+struct motion_history {
+    struct motion_sample samples[MOTION_SAMPLES];
+    int count;
+    long lead;             /* microseconds to look ahead, 0 for none */
+    long long stale;       /* microseconds after which a sample says nothing */
+    long long predicted;   /* when the last guess was made, 0 for none */
+    double vx, vy;         /* of the last guess, pixels per microsecond */
+    double ax, ay;         /* and per microsecond squared */
+    double error;          /* recent prediction error in pixels, decaying */
+};
+
+/**
+ * a mapped framebuffer, either the real panel or a file standing in for it
+ */
+struct fb_mem {
+    int fd;
+    unsigned char *base;
+    size_t size;
+    int width, height;
+    int stride;            /* bytes per line */
+    int bpp;
+    unsigned int marker;   /* last update marker handed to the driver */
+};
+
+/**
+ * A cursor drawn by pointer.c itself, pre-rasterized to 8 bpp so drawing
+ * it is a masked copy: pixels and mask have one byte per pixel, rows are
+ * padded to whole 32 bit words. under holds what the cursor covers.
+ */
+struct sw_cursor {
+    int width, height;
+    int xhot, yhot;
+    int stride;
+    unsigned char *pixels;
+    unsigned char *mask;
+    unsigned char *under;
+    struct rect drawn;     /* clipped area the cursor occupies, if shown */
+    int shown;
+};
+
+struct refresh_ctx;
+
+/**
+ * what an update is for: waveAuto lets the driver choose, waveFast is the
+ * quickest update that leaves ghosting behind and waveClean the full
+ * quality one that gets rid of it
+ */
+enum e_waveform {waveAuto, waveFast, waveClean};
+
+/**
+ * How a refresh actually reaches the panel. init() is called once the
+ * geometry is known, update() for each rectangle of a frame and destroy()
+ * on the way out.
+ */
+struct refresh_backend {
+    const char *name;
+    int  (*init)(struct refresh_ctx *ctx);
+    void (*update)(struct refresh_ctx *ctx, const struct rect *r, enum e_waveform wave);
+    void (*destroy)(struct refresh_ctx *ctx);
+};
+
+const struct refresh_backend *findBackend(const char *name);
+static int fbClip(const struct fb_mem *fb, const struct rect *r, struct rect *out);
+
+struct refresh_ctx {
+    const struct refresh_backend *backend;
+    const char *device;    /* framebuffer or file the backend works on */
+    struct fb_mem fb;
+    struct sw_cursor *cursor; /* drawn into fb, NULL to leave it to X */
+    Display *dpy;
+    int screen;
+    Window root;
+    Window win;
+    int display_width, display_height;
+    int centered;          /* follow the pointer instead of a fixed position */
+    int x, y;              /* fixed position, unless centered */
+    int width, height;
+    int win_x, win_y;      /* where the window currently is */
+    int pointer_x, pointer_y; /* pointer position of the last refresh */
+    int win_width, win_height; /* current size of the window */
+    struct rect box;       /* area refreshed for the last pointer position */
+    struct dirty_region dirty; /* of the last frame */
+    struct rect echo[MAX_DIRTY]; /* painted by the X backend's window this frame */
+    int echo_count;        /* each comes back as damage once */
+    struct dirty_region damage; /* drawn by other clients and not refreshed yet */
+    long damage_interval;  /* least milliseconds between its refreshes, 0 when not watching */
+    struct timespec damage_last;
+    int damage_event;      /* XDamageNotify on this display */
+    XID damage_handle;
+    int query_pending;     /* a refresh is waiting on the pointer position */
+    int query_ready;       /* and the position is in */
+    int query_moved;       /* only refresh if the pointer moved */
+    int query_x, query_y;
+#ifdef HAVE_XCB
+    xcb_connection_t *xcb; /* underneath dpy, for requests that don't wait */
+    xcb_query_pointer_cookie_t query_cookie;
+#endif
+    struct ghost_map ghost;
+    struct motion_history motion;
+    char *solidcolor;      /* owned copy of the Solid resource, if any */
+    XSetWindowAttributes xswa; /* for the refresh window */
+    unsigned long xswa_mask;
+};
+
+int xrefreshInit(struct refresh_ctx *ctx, Display *dpy, const struct refresh_backend *backend, const char *device, char *ProgramName, char *geom, enum e_action action, char *solidcolor);
+void xrefreshDestroy(struct refresh_ctx *ctx);
+void xrefresh(struct refresh_ctx *ctx);
+void xrefreshAt(struct refresh_ctx *ctx, int root_x, int root_y);
+void xrefreshBegin(struct refresh_ctx *ctx, int moved);
+void xrefreshCancel(struct refresh_ctx *ctx);
+int xrefreshReplied(struct refresh_ctx *ctx);
+int xrefreshPending(struct refresh_ctx *ctx);
+int xrefreshFinish(struct refresh_ctx *ctx, int wait);
+long xrefreshCleanupDue(struct refresh_ctx *ctx);
+void xrefreshCleanup(struct refresh_ctx *ctx, int min);
+int xrefreshDamageEvent(struct refresh_ctx *ctx, XEvent *event);
+int xrefreshDamageDrain(struct refresh_ctx *ctx);
+long xrefreshDamageDue(struct refresh_ctx *ctx);
+void xrefreshDamage(struct refresh_ctx *ctx);
 
 static int setupSignals() {
     struct sigaction act;
@@ -87,6 +312,13 @@ static int setupSignals() {
         return 0;
     }
 
+    act.sa_handler = statsSignalHandler;
+
+    if (sigaction(SIGUSR1, &act, NULL) == -1) {
+        perror("hhpc: could not register SIGUSR1");
+        return 0;
+    }
+
     return 1;
 }
 
@@ -99,313 +331,1913 @@ static void delay(time_t sec, long msec) {
     sleep.tv_sec  = sec;
     sleep.tv_nsec = (msec % 1000) * 1000 * 1000;
 
-    if (nanosleep(&sleep, NULL) == -1) {
-        signalHandler(0);
-    }
+    /* an interrupted sleep just ends early, the handler of the signal
+     * decides whether we keep on working */
+    nanosleep(&sleep, NULL);
+}
+
+static long rectArea(const struct rect *r) {
+    return (long) r->width * r->height;
+}
+
+static void rectUnion(struct rect *dst, const struct rect *a, const struct rect *b) {
+    int x0 = a->x < b->x ? a->x : b->x;
+    int y0 = a->y < b->y ? a->y : b->y;
+    int x1 = a->x + a->width  > b->x + b->width  ? a->x + a->width  : b->x + b->width;
+    int y1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+
+    dst->x      = x0;
+    dst->y      = y0;
+    dst->width  = x1 - x0;
+    dst->height = y1 - y0;
 }
 
 /**
- * generates an empty cursor,
- * don't forget to destroy the cursor with XFreeCursor
- *
- * do we need to use XAllocColor or will it always just work
- * as I've observed?
+ * overlapping or sharing an edge
  */
-static Cursor nullCursor(Display *dpy, Drawable dw) {
-    XColor color  = { 0 };
-    const char data[] = { 0 };
+static int rectTouches(const struct rect *a, const struct rect *b) {
+    return a->x <= b->x + b->width  && b->x <= a->x + a->width &&
+           a->y <= b->y + b->height && b->y <= a->y + a->height;
+}
 
-    Pixmap pixmap = XCreateBitmapFromData(dpy, dw, data, 1, 1);
-    Cursor cursor = XCreatePixmapCursor(dpy, pixmap, pixmap, &color, &color, 0, 0);
+static int rectContains(const struct rect *outer, const struct rect *inner) {
+    return inner->x >= outer->x && inner->x + inner->width  <= outer->x + outer->width &&
+           inner->y >= outer->y && inner->y + inner->height <= outer->y + outer->height;
+}
 
-    XFreePixmap(dpy, pixmap);
+static void dirtyInit(struct dirty_region *dirty, int screen_width, int screen_height, int align, int max) {
+    memset(dirty, 0, sizeof(*dirty));
 
-    return cursor;
+    dirty->screen_width  = screen_width;
+    dirty->screen_height = screen_height;
+    dirty->align         = align > 0 ? align : 1;
+    dirty->max           = max > 0 && max <= MAX_DIRTY ? max : MAX_DIRTY;
 }
 
-/**
- * returns 0 for failure, 1 for success
- */
-static int grabPointer(Display *dpy, Window win, Cursor cursor, unsigned int mask) {
-    int rc;
+static void dirtyAdd(struct dirty_region *dirty, const struct rect *r) {
+    struct rect add, merged;
+    int x1, y1, i;
+    int align = dirty->align;
 
-    /* retry until we actually get the pointer (with a suitable delay)
-     * or we get an error we can't recover from. */
-    while (working) {
-        rc = XGrabPointer(dpy, win, True, mask, GrabModeSync, GrabModeAsync, None, cursor, CurrentTime);
+    /* snap outwards to the alignment, then clip to the screen */
+    add.x = r->x - ((r->x % align) + align) % align;
+    add.y = r->y - ((r->y % align) + align) % align;
+    x1    = r->x + r->width  + align - 1;
+    y1    = r->y + r->height + align - 1;
+    x1   -= ((x1 % align) + align) % align;
+    y1   -= ((y1 % align) + align) % align;
 
-        switch (rc) {
-            case GrabSuccess:
-                if (gVerbose) fprintf(stderr, "hhpc: succesfully grabbed mouse pointer\n");
-                return 1;
+    if (add.x < 0) add.x = 0;
+    if (add.y < 0) add.y = 0;
+    if (x1 > dirty->screen_width)  x1 = dirty->screen_width;
+    if (y1 > dirty->screen_height) y1 = dirty->screen_height;
 
-            case AlreadyGrabbed:
-                if (gVerbose) fprintf(stderr, "hhpc: XGrabPointer: already grabbed mouse pointer, retrying with delay\n");
-                delay(0, 500);
-                break;
+    add.width  = x1 - add.x;
+    add.height = y1 - add.y;
 
-            case GrabFrozen:
-                if (gVerbose) fprintf(stderr, "hhpc: XGrabPointer: grab was frozen, retrying after delay\n");
-                delay(0, 500);
-                break;
+    if (add.width <= 0 || add.height <= 0) return;
 
-            case GrabNotViewable:
-                fprintf(stderr, "hhpc: XGrabPointer: grab was not viewable, exiting\n");
-                return 0;
+    /* absorb every rectangle it touches for free, a merge can make it
+     * touch others so start over after each one */
+    for (i = 0; i < dirty->count; ++i) {
+        if (!rectTouches(&add, &dirty->rects[i])) continue;
 
-            case GrabInvalidTime:
-                fprintf(stderr, "hhpc: XGrabPointer: invalid time, exiting\n");
-                return 0;
+        rectUnion(&merged, &add, &dirty->rects[i]);
+        if (rectArea(&merged) > rectArea(&add) + rectArea(&dirty->rects[i])) continue;
 
-            default:
-                fprintf(stderr, "hhpc: XGrabPointer: could not grab mouse pointer (%d), exiting\n", rc);
-                return 0;
-        }
+        add = merged;
+        dirty->rects[i] = dirty->rects[--dirty->count];
+        i = -1;
     }
 
-    return 0;
+    if (dirty->count < dirty->max) {
+        dirty->rects[dirty->count++] = add;
+        return;
+    }
+
+    /* too many pieces, one update of the bounding box is cheaper */
+    for (i = 0; i < dirty->count; ++i) {
+        rectUnion(&add, &add, &dirty->rects[i]);
+    }
+
+    dirty->rects[0] = add;
+    dirty->count    = 1;
 }
 
-static void waitForMotion(Display *dpy, Window win, int timeout) {
-    int ready = 0;
-    int xfd   = ConnectionNumber(dpy);
-    int xrefresh_argc = 3;
-    char xrefresh_argv[32][32] ={0};
+/**
+ * adds boxes of the given size along the straight line between two
+ * positions, covering where the pointer went while refreshes were held
+ * back. The end points themselves are not added.
+ */
+static void dirtyAddPath(struct dirty_region *dirty, int x0, int y0, int x1, int y1, int width, int height) {
+    struct rect step;
+    int dx = x1 - x0, dy = y1 - y0;
+    int dist = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+    int spacing = (width < height ? width : height) / 2;
+    int steps, i;
 
-    const unsigned int mask = PointerMotionMask | ButtonPressMask;
+    if (spacing <= 0) spacing = 1;
 
-    fd_set fds;
+    steps = dist / spacing;
 
-    XEvent event;
-sprintf(xrefresh_argv[0], "pointer.lix");
-    sprintf(xrefresh_argv[1], "-g");
-    sprintf(xrefresh_argv[2], "50x50+50+50");
+    step.width  = width;
+    step.height = height;
 
-    
-    working = 1;
+    for (i = 1; i < steps; ++i) {
+        step.x = x0 + dx * i / steps - width / 2;
+        step.y = y0 + dy * i / steps - height / 2;
 
-    if (!setupSignals()) {
-        fprintf(stderr, "hhpc: could not register signals, program will not exit cleanly\n");
+        dirtyAdd(dirty, &step);
     }
+}
 
-    while (working && grabPointer(dpy, win, None, mask)) {
-        /* we grab in sync mode, which stops pointer events from processing,
-         * so we explicitly have to re-allow it with XAllowEvents. The old
-         * method was to just grab in async mode so we wouldn't need this,
-         * but that disables replaying the pointer events */
-        XAllowEvents(dpy, SyncPointer, CurrentTime);
-
-        /* syncing is necessary, otherwise the X11 FD will never receive an
-         * event (and thus will never be ready, strangely enough) */
-        XSync(dpy, False);
+static void ghostFree(struct ghost_map *ghost) {
+    free(ghost->tiles);
+    free(ghost->rects);
 
-        /* add the X11 fd to the fdset so we can poll/select on it */
-        FD_ZERO(&fds);
-        FD_SET(xfd, &fds);
+    ghost->tiles = NULL;
+    ghost->rects = NULL;
+    ghost->limit = 0;
+}
 
-        /* we poll on the X11 fd to see if an event has come in, select()
-         * is interruptible by signals, which allows ctrl+c to work. If we
-         * were to just use XNextEvent() (which blocks), ctrl+c would not
-         * work. */
-        ready = select(xfd + 1, &fds, NULL, NULL, NULL);
+static int ghostInit(struct ghost_map *ghost, int screen_width, int screen_height, int limit, long idle) {
+    memset(ghost, 0, sizeof(*ghost));
 
-        if (ready > 0) {
-            if (gVerbose) fprintf(stderr, "hhpc: event received, ungrabbing and sleeping\n");
+    if (limit <= 0) return 1;
 
-            /* event received, replay event, release mouse, drain, sleep, regrab */
-            XAllowEvents(dpy, ReplayPointer, CurrentTime);
-            XUngrabPointer(dpy, CurrentTime);
+    ghost->cols  = (screen_width  + TILE_SIZE - 1) / TILE_SIZE;
+    ghost->rows  = (screen_height + TILE_SIZE - 1) / TILE_SIZE;
+    ghost->tiles = calloc(ghost->cols * ghost->rows, 1);
+    ghost->rects = calloc(ghost->cols * ghost->rows, sizeof(struct rect));
+    if (!ghost->tiles || !ghost->rects) {
+        ghostFree(ghost);
+        return 0;
+    }
 
-//            /* drain events */
-//            while (XPending(dpy)) {
-//                XMaskEvent(dpy, mask, &event);
-//
-//                if (gVerbose) fprintf(stderr, "hhpc: draining event Type %d\n", event.type);
-//
-//            }
+    ghost->screen_width  = screen_width;
+    ghost->screen_height = screen_height;
 
-	if( XPending(dpy) ){
-                XMaskEvent(dpy, mask, &event);
+    ghost->limit = limit > 255 ? 255 : limit;
+    ghost->idle  = idle;
 
-                if (gVerbose) fprintf(stderr, "hhpc: draining event Type %d\n", event.type);
+    return 1;
+}
 
-            }
-xrefresh(dpy, xrefresh_argv[0], NULL, xrefresh_argv[2], doDefault, NULL);
-            delay(timeout, 0);
-		
-	
-        }
-        else if (ready == 0) {
-            if (gVerbose) fprintf(stderr, "hhpc: timeout\n");
-        }
-        else {
-            if (working) perror("hhpc: error while select()'ing");
+/**
+ * counts a fast update of r against every tile it touches
+ */
+static void ghostMark(struct ghost_map *ghost, const struct rect *r) {
+    unsigned char *tile;
+    int col, row, col0, col1, row1;
+
+    col0 = r->x / TILE_SIZE;
+    col1 = (r->x + r->width - 1) / TILE_SIZE;
+    row1 = (r->y + r->height - 1) / TILE_SIZE;
+    if (col1 >= ghost->cols) col1 = ghost->cols - 1;
+    if (row1 >= ghost->rows) row1 = ghost->rows - 1;
+
+    for (row = r->y / TILE_SIZE; row <= row1; ++row) {
+        for (col = col0; col <= col1; ++col) {
+            tile = &ghost->tiles[row * ghost->cols + col];
+
+            if (*tile == ghost->limit) continue;
+            if (*tile == 0) ghost->pending++;
+            if (++*tile == ghost->limit) ghost->over++;
         }
     }
 
-    XUngrabPointer(dpy, CurrentTime);
+    clock_gettime(CLOCK_MONOTONIC, &ghost->last);
 }
 
-static int parseOptions(int argc, char *argv[]) {
-    int option = 0;
+/**
+ * Resets every tile with at least min updates and returns them as
+ * rectangles in ghost->rects, clipped to the screen. Runs of tiles in a
+ * row make one rectangle, and a run that spans the same columns as one in
+ * the row above extends it downwards. Nothing is merged beyond that, so
+ * only what took the updates gets cleaned however scattered it is.
+ */
+static int ghostCollect(struct ghost_map *ghost, int min) {
+    struct rect *r;
+    unsigned char *count;
+    int col, row, start, i, n = 0;
+
+    for (row = 0; row < ghost->rows; ++row) {
+        for (col = 0; col < ghost->cols; ++col) {
+            count = &ghost->tiles[row * ghost->cols + col];
+            if (!*count || *count < min) continue;
+
+            for (start = col; col < ghost->cols; ++col) {
+                count = &ghost->tiles[row * ghost->cols + col];
+                if (!*count || *count < min) break;
+
+                if (*count == ghost->limit) ghost->over--;
+                ghost->pending--;
+                *count = 0;
+            }
 
-    while ((option = getopt(argc, argv, "i:v")) != -1) {
-        switch (option) {
-            case 'i': gIdleTimeout = atoi(optarg); break;
-            case 'v': gVerbose = 1; break;
-            default: return 0;
+            /* one that ends on the row above with the same columns */
+            r = NULL;
+            for (i = 0; i < n && !r; ++i) {
+                if (ghost->rects[i].x == start * TILE_SIZE &&
+                    ghost->rects[i].width == (col - start) * TILE_SIZE &&
+                    ghost->rects[i].y + ghost->rects[i].height == row * TILE_SIZE) {
+                    r = &ghost->rects[i];
+                }
+            }
+
+            if (r) {
+                r->height += TILE_SIZE;
+            }
+            else {
+                r = &ghost->rects[n++];
+                r->x      = start * TILE_SIZE;
+                r->y      = row * TILE_SIZE;
+                r->width  = (col - start) * TILE_SIZE;
+                r->height = TILE_SIZE;
+            }
         }
     }
 
-    return 1;
+    for (i = 0; i < n; ++i) {
+        r = &ghost->rects[i];
+        if (r->x + r->width  > ghost->screen_width)  r->width  = ghost->screen_width  - r->x;
+        if (r->y + r->height > ghost->screen_height) r->height = ghost->screen_height - r->y;
+    }
+
+    return n;
 }
 
-static void usage() {
-    printf("hhpc [-i] seconds [-v]\n");
+/**
+ * PCF reading, just enough of it to pull two glyphs out of a cursor font.
+ * Every table says for itself which byte and bit order it uses.
+ */
+#define PCF_METRICS             (1 << 2)
+#define PCF_BITMAPS             (1 << 3)
+#define PCF_BDF_ENCODINGS       (1 << 5)
+
+#define PCF_GLYPH_PAD_MASK      (3 << 0)
+#define PCF_BYTE_MASK           (1 << 2)
+#define PCF_BIT_MASK            (1 << 3)
+#define PCF_SCAN_UNIT_MASK      (3 << 4)
+#define PCF_COMPRESSED_METRICS  0x100
+
+struct pcf_glyph {
+    int lsb, rsb;          /* left and right side bearing */
+    int ascent, descent;
+    const unsigned char *bits;
+    int row_bytes;
+    int msbit_first;
+};
+
+static uint32_t pcfRead32(const unsigned char *p, int msb) {
+    return msb ? (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]
+               : (uint32_t) p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
 }
 
-int main(int argc, char *argv[]) {
-    if (!parseOptions(argc, argv)) {
-        usage();
+static int pcfRead16(const unsigned char *p, int msb) {
+    return (int16_t) (msb ? p[0] << 8 | p[1] : p[1] << 8 | p[0]);
+}
 
-        return 1;
+/**
+ * finds a table, returns a pointer to its format word and its size
+ */
+static const unsigned char *pcfTable(const unsigned char *font, size_t len, uint32_t type, size_t *size) {
+    uint32_t count, i, offset;
+
+    if (len < 8 || memcmp(font, "\1fcp", 4) != 0) return NULL;
+
+    count = pcfRead32(font + 4, 0);
+
+    for (i = 0; i < count && 8 + 16 * (i + 1) <= len; ++i) {
+        const unsigned char *toc = font + 8 + 16 * i;
+
+        if (pcfRead32(toc, 0) != type) continue;
+
+        *size  = pcfRead32(toc + 8, 0);
+        offset = pcfRead32(toc + 12, 0);
+
+        if (offset > len || *size > len - offset || *size < 4) return NULL;
+
+        return font + offset;
     }
 
-    char *displayName = getenv("DISPLAY");
+    return NULL;
+}
 
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) {
-        if (!displayName || strlen(displayName) == 0) {
-            fprintf(stderr, "hhpc: could not open display, DISPLAY environment variable not set, are you sure the X server is started?\n");
-            return 2;
-        }
-        else {
-            fprintf(stderr, "hhpc: could not open display %s, check if your X server is running and/or the DISPLAY environment value is correct\n", displayName);
-            return 1;
-        }
+/**
+ * looks up the glyph for a character code, returns 0 for failure, 1 for success
+ */
+static int pcfGlyph(const unsigned char *font, size_t len, unsigned int code, struct pcf_glyph *glyph) {
+    const unsigned char *enc, *met, *bmp;
+    size_t enc_size, met_size, bmp_size;
+    uint32_t format;
+    int msb, first, last, index, count, pad;
+    uint32_t offset;
+
+    enc = pcfTable(font, len, PCF_BDF_ENCODINGS, &enc_size);
+    met = pcfTable(font, len, PCF_METRICS, &met_size);
+    bmp = pcfTable(font, len, PCF_BITMAPS, &bmp_size);
+    if (!enc || !met || !bmp) return 0;
+
+    /* single byte encodings only, which is what cursor fonts use */
+    format = pcfRead32(enc, 0);
+    msb    = format & PCF_BYTE_MASK;
+    first  = pcfRead16(enc + 4, msb);
+    last   = pcfRead16(enc + 6, msb);
+    if (code < (unsigned int) first || code > (unsigned int) last) return 0;
+    if (14 + 2 * (code - first) + 2 > enc_size) return 0;
+
+    index = pcfRead16(enc + 14 + 2 * (code - first), msb) & 0xffff;
+    if (index == 0xffff) return 0;
+
+    format = pcfRead32(met, 0);
+    msb    = format & PCF_BYTE_MASK;
+    if (format & PCF_COMPRESSED_METRICS) {
+        count = pcfRead16(met + 4, msb);
+        if (index >= count || 6 + 5 * (size_t) (index + 1) > met_size) return 0;
+
+        met += 6 + 5 * index;
+        glyph->lsb     = met[0] - 0x80;
+        glyph->rsb     = met[1] - 0x80;
+        glyph->ascent  = met[3] - 0x80;
+        glyph->descent = met[4] - 0x80;
+    }
+    else {
+        count = pcfRead32(met + 4, msb);
+        if (index >= count || 8 + 12 * (size_t) (index + 1) > met_size) return 0;
+
+        met += 8 + 12 * index;
+        glyph->lsb     = pcfRead16(met, msb);
+        glyph->rsb     = pcfRead16(met + 2, msb);
+        glyph->ascent  = pcfRead16(met + 6, msb);
+        glyph->descent = pcfRead16(met + 8, msb);
     }
 
-    int scr        = DefaultScreen(dpy);
-    Window rootwin = RootWindow(dpy, scr);
+    format = pcfRead32(bmp, 0);
+    msb    = format & PCF_BYTE_MASK;
+    count  = pcfRead32(bmp + 4, msb);
+    if (index >= count || 8 + 4 * (size_t) count + 16 > bmp_size) return 0;
 
-    if (gVerbose) fprintf(stderr, "hhpc: got root window, screen = %d, display = %p, rootwin = %d\n", scr, (void *) dpy, (int) rootwin);
+    /* bitmaps whose bit and byte order differ would need their scan units
+     * swapped, cursor fonts are written with both the same */
+    if (!(format & PCF_BYTE_MASK) != !(format & PCF_BIT_MASK) && (format & PCF_SCAN_UNIT_MASK)) {
+        fprintf(stderr, "hhpc: unsupported PCF bitmap format %x\n", format);
+        return 0;
+    }
 
-    waitForMotion(dpy, rootwin, gIdleTimeout);
+    pad    = 1 << (format & PCF_GLYPH_PAD_MASK);
+    offset = pcfRead32(bmp + 8 + 4 * index, msb);
 
-    XCloseDisplay(dpy);
+    glyph->row_bytes   = ((glyph->rsb - glyph->lsb + 7) / 8 + pad - 1) / pad * pad;
+    glyph->bits        = bmp + 8 + 4 * count + 16 + offset;
+    glyph->msbit_first = format & PCF_BIT_MASK;
 
-    return 0;
+    if (glyph->rsb < glyph->lsb || glyph->ascent + glyph->descent < 0 ||
+        8 + 4 * (size_t) count + 16 + offset + (size_t) glyph->row_bytes * (glyph->ascent + glyph->descent) > bmp_size) {
+        return 0;
+    }
+
+    return 1;
 }
 
-char *ProgramName;
+static int pcfBit(const struct pcf_glyph *glyph, int x, int y) {
+    unsigned char byte;
 
-static void 
-Syntax(void)
-{
-    fprintf (stderr, "usage:  %s [-options] [geometry] [display]\n\n", 
-    	     ProgramName);
-    fprintf (stderr, "where the available options are:\n");
-    fprintf (stderr, "    -display host:dpy       or -d\n");
-    fprintf (stderr, "    -geometry WxH+X+Y       or -g spec\n");
-    fprintf (stderr, "    -black                  use BlackPixel\n");
-    fprintf (stderr, "    -white                  use WhitePixel\n");
-    fprintf (stderr, "    -solid colorname        use the color indicated\n");
-    fprintf (stderr, "    -root                   use the root background\n");
-    fprintf (stderr, "    -none                   no background in window\n");
-    fprintf (stderr, "\nThe default is:  %s -none\n\n", ProgramName);
-    exit (1);
+    x -= glyph->lsb;
+    y += glyph->ascent;
+
+    if (x < 0 || x >= glyph->rsb - glyph->lsb || y < 0 || y >= glyph->ascent + glyph->descent) return 0;
+
+    byte = glyph->bits[y * glyph->row_bytes + x / 8];
+
+    return glyph->msbit_first ? byte >> (7 - x % 8) & 1 : byte >> (x % 8) & 1;
 }
 
-/*
- * The following parses options that should be yes or no; it returns -1, 0, 1
- * for error, no, yes.
+/**
+ * Loads a cursor shape and its mask (the glyph after it, as in the X
+ * cursor font) and rasterizes them once: black where the shape is set,
+ * white elsewhere inside the mask. returns 0 for failure, 1 for success
  */
+static int cursorLoad(struct sw_cursor *cur, const char *path, unsigned int shape) {
+    struct pcf_glyph src, msk;
+    unsigned char *font;
+    FILE *fp;
+    long len;
+    int left, right, ascent, descent, x, y, ok;
+
+    memset(cur, 0, sizeof(*cur));
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "hhpc: could not open cursor font %s: %s\n", path, strerror(errno));
+        return 0;
+    }
 
-static int 
-parse_boolean_option(char *option)
-{
-    static struct _booltable {
-        char *name;
-        int value;
-    } booltable[] = {
-        { "off", 0 }, { "n", 0 }, { "no", 0 }, { "false", 0 },
-        { "on", 1 }, { "y", 1 }, { "yes", 1 }, { "true", 1 },
-        { NULL, -1 }};
-    register struct _booltable *t;
-    register char *cp;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
 
-    for (cp = option; *cp; cp++) {
-        if (isascii (*cp) && isupper (*cp)) *cp = tolower (*cp);
-    }
+    font = len > 0 ? malloc(len) : NULL;
+    ok   = font && fread(font, 1, len, fp) == (size_t) len;
+    fclose(fp);
 
-    for (t = booltable; t->name; t++) {
-        if (strcmp (option, t->name) == 0) return (t->value);
+    ok = ok && pcfGlyph(font, len, shape, &src) && pcfGlyph(font, len, shape + 1, &msk);
+    if (!ok) {
+        fprintf(stderr, "hhpc: could not read glyph %u from %s\n", shape, path);
+        free(font);
+        return 0;
     }
-    return (-1);
-}
 
+    left    = src.lsb < msk.lsb ? src.lsb : msk.lsb;
+    right   = src.rsb > msk.rsb ? src.rsb : msk.rsb;
+    ascent  = src.ascent > msk.ascent ? src.ascent : msk.ascent;
+    descent = src.descent > msk.descent ? src.descent : msk.descent;
+
+    cur->width  = right - left;
+    cur->height = ascent + descent;
+    cur->xhot   = -left;
+    cur->yhot   = ascent;
+    cur->stride = (cur->width + 3) & ~3;
+
+    cur->pixels = calloc(cur->stride, cur->height);
+    cur->mask   = calloc(cur->stride, cur->height);
+    cur->under  = calloc(cur->stride, cur->height);
+    if (!cur->pixels || !cur->mask || !cur->under) {
+        free(cur->pixels);
+        free(cur->mask);
+        free(cur->under);
+        free(font);
+        return 0;
+    }
 
-/*
- * The following is a hack until XrmParseCommand is ready.  It determines
- * whether or not the given string is an abbreviation of the arg.
- */
+    for (y = 0; y < cur->height; ++y) {
+        for (x = 0; x < cur->width; ++x) {
+            if (!pcfBit(&msk, x + left, y - ascent)) continue;
 
-static Bool 
-isabbreviation(char *arg, char *s, int minslen)
-{
-    int arglen;
-    int slen;
+            cur->mask[y * cur->stride + x]   = 0xff;
+            cur->pixels[y * cur->stride + x] = pcfBit(&src, x + left, y - ascent) ? 0x00 : 0xff;
+        }
+    }
 
-    /* exact match */
-    if (strcmp (arg, s) == 0) return (True);
+    free(font);
 
-    arglen = strlen (arg);
-    slen = strlen (s);
+    if (gVerbose) fprintf(stderr, "hhpc: loaded %dx%d cursor, hotspot %d,%d\n", cur->width, cur->height, cur->xhot, cur->yhot);
 
-    /* too long or too short */
-    if (slen >= arglen || slen < minslen) return (False);
+    return 1;
+}
 
-    /* abbreviation */
-    if (strncmp (arg, s, slen) == 0) return (True);
+static void cursorFree(struct sw_cursor *cur) {
+    free(cur->pixels);
+    free(cur->mask);
+    free(cur->under);
 
-    /* bad */
-    return (False);
+    memset(cur, 0, sizeof(*cur));
 }
 
-struct s_pair {
-	char *resource_name;
-	enum e_action action;
-} pair_table[] = {
-	{ "Black", doBlack },
-	{ "White", doWhite },
-	{ "None", doNone },
-	{ "Root", doRoot },
-	{ NULL, doDefault }};
+/**
+ * the area the cursor covers with its hotspot at x,y
+ */
+static void cursorBox(const struct sw_cursor *cur, int x, int y, struct rect *box) {
+    box->x      = x - cur->xhot;
+    box->y      = y - cur->yhot;
+    box->width  = cur->width;
+    box->height = cur->height;
+}
 
-int
-xrefresh(Display *dpy, char *ProgramName, char *displayname, char *geom, enum e_action action, char *solidcolor)
-{
-    Visual visual;
-    XSetWindowAttributes xswa;
+/**
+ * dst = (dst & ~mask) | (src & mask), a word at a time
+ */
+static void blendRow(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int len) {
+    uint32_t d, s, m;
     int i;
-    Colormap cmap;
-    unsigned long mask;
-    int screen;
-    int x, y, width, height;
-    int geom_result;
-    int display_width, display_height;
-    XColor cdef;
-int win_x, win_y, root_x, root_y = 0;
-    unsigned int query_mask = 0;
-    Window child_win, root_win;
 
+    for (i = 0; i + 4 <= len; i += 4) {
+        memcpy(&d, dst + i, 4);
+        memcpy(&s, src + i, 4);
+        memcpy(&m, mask + i, 4);
 
-    if (action == doDefault) {
-	char *def;
+        d = (d & ~m) | (s & m);
+        memcpy(dst + i, &d, 4);
+    }
 
-	if ((def = XGetDefault (dpy, ProgramName, "Solid")) != NULL) {
-	    solidcolor = strdup (def);
-	    if (solidcolor == NULL) {
+    for (; i < len; ++i) {
+        dst[i] = (dst[i] & ~mask[i]) | (src[i] & mask[i]);
+    }
+}
+
+/**
+ * saves what is under the cursor and draws it with its hotspot at x,y
+ */
+static void cursorShow(struct sw_cursor *cur, struct fb_mem *fb, int x, int y) {
+    struct rect box;
+    int x0, y0, row;
+    size_t src, dst;
+
+    cursorBox(cur, x, y, &box);
+    if (!fbClip(fb, &box, &cur->drawn)) return;
+
+    /* offset of the visible part inside the cursor image */
+    x0 = cur->drawn.x - box.x;
+    y0 = cur->drawn.y - box.y;
+
+    for (row = 0; row < cur->drawn.height; ++row) {
+        src = (size_t) (y0 + row) * cur->stride + x0;
+        dst = (size_t) (cur->drawn.y + row) * fb->stride + cur->drawn.x;
+
+        memcpy(cur->under + (size_t) row * cur->stride, fb->base + dst, cur->drawn.width);
+        blendRow(fb->base + dst, cur->pixels + src, cur->mask + src, cur->drawn.width);
+    }
+
+    cur->shown = 1;
+}
+
+/**
+ * puts back what the cursor covered. Anything X drew there in the meantime
+ * is lost until X redraws it.
+ */
+static void cursorHide(struct sw_cursor *cur, struct fb_mem *fb) {
+    int row;
+
+    if (!cur->shown) return;
+
+    for (row = 0; row < cur->drawn.height; ++row) {
+        memcpy(fb->base + (size_t) (cur->drawn.y + row) * fb->stride + cur->drawn.x,
+               cur->under + (size_t) row * cur->stride, cur->drawn.width);
+    }
+
+    cur->shown = 0;
+}
+
+/**
+ * The refresh scheduler. Motion only marks the frame dirty; the refresh
+ * itself is issued at most once per interval and always picks up the
+ * newest pointer position, so any amount of motion in between collapses
+ * into a single refresh. After a refresh the scheduler keeps "settling"
+ * for one more interval, so the position the pointer comes to rest at is
+ * always refreshed too.
+ */
+struct frame_sched {
+    long interval;          /* milliseconds between two refreshes */
+    struct timespec last;   /* when the last refresh was issued */
+    int dirty;              /* motion seen since the last refresh */
+    int settling;           /* a trailing check is still owed */
+};
+
+static long elapsedMs(const struct timespec *since) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / (1000 * 1000);
+}
+
+/**
+ * returns the milliseconds until the scheduler wants to run again,
+ * 0 if that is now and -1 if there is nothing to do
+ */
+static long schedTimeout(const struct frame_sched *sched) {
+    long left;
+
+    if (!sched->dirty && !sched->settling) return -1;
+
+    left = sched->interval - elapsedMs(&sched->last);
+
+    return left > 0 ? left : 0;
+}
+
+static void schedRefreshed(struct frame_sched *sched) {
+    clock_gettime(CLOCK_MONOTONIC, &sched->last);
+
+    sched->dirty    = 0;
+    sched->settling = 1;
+}
+
+/**
+ * a refresh started earlier went out, motion seen since it was started
+ * is still owed one of its own
+ */
+static void schedFinished(struct frame_sched *sched) {
+    clock_gettime(CLOCK_MONOTONIC, &sched->last);
+
+    sched->settling = 1;
+}
+
+/**
+ * the sooner of two timeouts, -1 being none
+ */
+static long earliest(long a, long b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+
+    return a < b ? a : b;
+}
+
+/**
+ * Latency and traffic statistics. Each frame is timestamped at every stage
+ * it goes through, from the input event to the refresh having been handed
+ * off, and the time between stages goes into fixed-bucket histograms. The
+ * X input modes only learn about an event when they wake up for it, so
+ * there the input stamp is the wakeup. Dumped on SIGUSR1, and to the
+ * stats file (-S) every gStatsPeriod seconds while there is activity.
+ */
+enum e_stage {stageInput, stageWakeup, stageCoalesce, stageIssue, stageDone, stageCount};
+
+#define STAT_BUCKETS 12
+
+/* upper bounds of the buckets in milliseconds, the last one is open */
+static const long statBounds[STAT_BUCKETS - 1] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000 };
+
+struct histogram {
+    const char *name;
+    enum e_stage from, to;
+    unsigned long bucket[STAT_BUCKETS];
+    unsigned long count;
+    long long total;       /* microseconds */
+    long long max;
+};
+
+static struct stats {
+    unsigned long events;      /* input events seen, an event device frame is one */
+    unsigned long wakeups;     /* times the loop woke up for input */
+    unsigned long refreshes;
+    unsigned long rects;
+    unsigned long long pixels;
+    unsigned long roundtrips;  /* X requests that wait for a reply */
+    unsigned long fast;        /* rects updated with the fast waveform */
+    unsigned long cleanups;    /* rects cleaned of ghosting */
+    unsigned long predictions; /* refreshes that covered a predicted path */
+    unsigned long unsure;      /* moves the prediction was not trusted for */
+    unsigned long checked;     /* predictions compared with the real position */
+    double errorTotal;         /* pixels */
+    double errorMax;
+    unsigned long damage;      /* damage rects reported by X */
+    unsigned long echoes;      /* of those, ones caused by our own refreshes */
+    unsigned long damageRefreshes; /* refreshes for damage alone */
+    Display *dpy;              /* to count the requests sent */
+    long long stamp[stageCount]; /* of the frame in progress, 0 if not reached */
+    struct timespec written;   /* last write of the stats file */
+    struct histogram hist[5];
+} gStats = {
+    .hist = {
+        { "delivery", stageInput,    stageWakeup },
+        { "drain",    stageWakeup,   stageCoalesce },
+        { "throttle", stageCoalesce, stageIssue },
+        { "refresh",  stageIssue,    stageDone },
+        { "total",    stageInput,    stageDone },
+    },
+};
+
+static long long monotonicUs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/**
+ * evdev stamps events with the wall clock, move it over to the monotonic one
+ */
+static long long eventTimeUs(const struct timeval *tv) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return monotonicUs() - ((now.tv_sec - tv->tv_sec) * 1000000LL + (now.tv_usec - tv->tv_usec));
+}
+
+/**
+ * records a stage of the current frame, only the first time it is reached
+ */
+static void statsStamp(enum e_stage stage, long long us) {
+    if (!gStats.stamp[stage]) gStats.stamp[stage] = us ? us : monotonicUs();
+}
+
+static void statsFrameDone() {
+    struct histogram *h;
+    long long us;
+    size_t i;
+    int b;
+
+    statsStamp(stageDone, 0);
+
+    for (i = 0; i < sizeof(gStats.hist) / sizeof(gStats.hist[0]); ++i) {
+        h = &gStats.hist[i];
+
+        if (!gStats.stamp[h->from] || !gStats.stamp[h->to]) continue;
+
+        us = gStats.stamp[h->to] - gStats.stamp[h->from];
+        if (us < 0) us = 0;
+
+        for (b = 0; b < STAT_BUCKETS - 1 && us >= statBounds[b] * 1000; ++b);
+
+        h->bucket[b]++;
+        h->count++;
+        h->total += us;
+        if (us > h->max) h->max = us;
+    }
+
+    gStats.refreshes++;
+
+    memset(gStats.stamp, 0, sizeof(gStats.stamp));
+}
+
+static void statsWrite(FILE *fp) {
+    const struct histogram *h;
+    size_t i;
+    int b;
+
+    fprintf(fp, "events %lu wakeups %lu refreshes %lu rects %lu pixels %llu roundtrips %lu requests %lu fast %lu cleanups %lu\n",
+            gStats.events, gStats.wakeups, gStats.refreshes, gStats.rects, gStats.pixels, gStats.roundtrips,
+            gStats.dpy ? XNextRequest(gStats.dpy) - 1 : 0, gStats.fast, gStats.cleanups);
+
+    if (gPredictLead) {
+        fprintf(fp, "predict  n %lu unsure %lu error avg %.1f px max %.1f px\n", gStats.predictions, gStats.unsure,
+                gStats.checked ? gStats.errorTotal / gStats.checked : 0.0, gStats.errorMax);
+    }
+
+    if (gDamageInterval) {
+        fprintf(fp, "damage   n %lu echoes %lu refreshes %lu\n", gStats.damage, gStats.echoes, gStats.damageRefreshes);
+    }
+
+    for (i = 0; i < sizeof(gStats.hist) / sizeof(gStats.hist[0]); ++i) {
+        h = &gStats.hist[i];
+
+        fprintf(fp, "%-8s n %lu avg %.1f ms max %.1f ms |", h->name, h->count,
+                h->count ? h->total / 1000.0 / h->count : 0.0, h->max / 1000.0);
+
+        for (b = 0; b < STAT_BUCKETS - 1; ++b) {
+            fprintf(fp, " <%ld:%lu", statBounds[b], h->bucket[b]);
+        }
+        fprintf(fp, " >=%ld:%lu\n", statBounds[STAT_BUCKETS - 2], h->bucket[STAT_BUCKETS - 1]);
+    }
+}
+
+/**
+ * dumps the stats if they were asked for or the stats file is due
+ */
+static void statsPoll() {
+    FILE *fp;
+
+    if (!dumpStats && !(gStatsFile && elapsedMs(&gStats.written) >= gStatsPeriod * 1000)) return;
+
+    dumpStats = 0;
+    clock_gettime(CLOCK_MONOTONIC, &gStats.written);
+
+    if (!gStatsFile) {
+        statsWrite(stderr);
+        return;
+    }
+
+    fp = fopen(gStatsFile, "w");
+    if (!fp) {
+        fprintf(stderr, "hhpc: could not write %s: %s\n", gStatsFile, strerror(errno));
+        return;
+    }
+
+    statsWrite(fp);
+    fclose(fp);
+}
+
+static void motionInit(struct motion_history *motion, long lead, long interval) {
+    memset(motion, 0, sizeof(*motion));
+
+    motion->lead  = lead * 1000;
+    motion->stale = (interval > 0 ? interval : 1) * 4000LL;
+}
+
+/**
+ * Adds the position of a refresh and checks the last guess against it,
+ * carried on to the time of the new position. One that comes in after a
+ * rest is a new move, not something the guess could have known about.
+ */
+static void motionAdd(struct motion_history *motion, int x, int y, long long us) {
+    double t, ex, ey, error;
+
+    if (motion->predicted && us - motion->predicted <= motion->stale) {
+        t = us - motion->predicted;
+
+        ex = motion->samples[0].x + motion->vx * t + motion->ax * t * t / 2 - x;
+        ey = motion->samples[0].y + motion->vy * t + motion->ay * t * t / 2 - y;
+        error = sqrt(ex * ex + ey * ey);
+
+        motion->error = motion->error * 0.75 + error * 0.25;
+
+        gStats.checked++;
+        gStats.errorTotal += error;
+        if (error > gStats.errorMax) gStats.errorMax = error;
+    }
+    motion->predicted = 0;
+
+    /* after a rest the old positions say nothing about the new move */
+    if (motion->count && us - motion->samples[0].us > motion->stale) motion->count = 0;
+
+    memmove(&motion->samples[1], &motion->samples[0], sizeof(motion->samples[0]) * (MOTION_SAMPLES - 1));
+    motion->samples[0].x  = x;
+    motion->samples[0].y  = y;
+    motion->samples[0].us = us;
+    if (motion->count < MOTION_SAMPLES) motion->count++;
+}
+
+/**
+ * Guesses where the pointer will be lead microseconds after the newest
+ * sample, from the velocity of the last two samples and the change in
+ * velocity over the last three. The acceleration may bend the guess but
+ * not make up more than half of it, the guess is never more than maxX,maxY
+ * away, and it is not made at all when it would be a smaller move than the
+ * recent guesses were off by. Returns 0 without a guess.
+ */
+static int motionPredict(struct motion_history *motion, int maxX, int maxY, int *x, int *y) {
+    const struct motion_sample *s = motion->samples;
+    double t = motion->lead, dt, dt2, dx, dy, bx, by, distance;
+
+    motion->predicted = 0;
+
+    if (!motion->lead || motion->count < 2) return 0;
+
+    dt = s[0].us - s[1].us;
+    if (dt <= 0) return 0;
+
+    motion->vx = (s[0].x - s[1].x) / dt;
+    motion->vy = (s[0].y - s[1].y) / dt;
+    motion->ax = motion->ay = 0;
+
+    if (motion->count > 2 && (dt2 = s[1].us - s[2].us) > 0) {
+        motion->ax = (motion->vx - (s[1].x - s[2].x) / dt2) * 2 / (dt + dt2);
+        motion->ay = (motion->vy - (s[1].y - s[2].y) / dt2) * 2 / (dt + dt2);
+    }
+
+    /* half of the straight line guess in either direction */
+    bx = fabs(motion->vx * t) / 2;
+    by = fabs(motion->vy * t) / 2;
+    if (fabs(motion->ax * t * t / 2) > bx) motion->ax = copysign(bx * 2 / (t * t), motion->ax);
+    if (fabs(motion->ay * t * t / 2) > by) motion->ay = copysign(by * 2 / (t * t), motion->ay);
+
+    dx = motion->vx * t + motion->ax * t * t / 2;
+    dy = motion->vy * t + motion->ay * t * t / 2;
+
+    if (dx >  maxX) dx =  maxX;
+    if (dx < -maxX) dx = -maxX;
+    if (dy >  maxY) dy =  maxY;
+    if (dy < -maxY) dy = -maxY;
+
+    /* the guess is checked either way, the refresh only follows a sure one */
+    motion->predicted = s[0].us;
+
+    distance = sqrt(dx * dx + dy * dy);
+    if (distance < 1 || distance <= motion->error) {
+        gStats.unsure++;
+        return 0;
+    }
+
+    *x = s[0].x + (int) lround(dx);
+    *y = s[0].y + (int) lround(dy);
+    gStats.predictions++;
+
+    return 1;
+}
+
+/**
+ * generates an empty cursor,
+ * don't forget to destroy the cursor with XFreeCursor
+ *
+ * do we need to use XAllocColor or will it always just work
+ * as I've observed?
+ */
+static Cursor nullCursor(Display *dpy, Drawable dw) {
+    XColor color  = { 0 };
+    const char data[] = { 0 };
+
+    Pixmap pixmap = XCreateBitmapFromData(dpy, dw, data, 1, 1);
+    Cursor cursor = XCreatePixmapCursor(dpy, pixmap, pixmap, &color, &color, 0, 0);
+
+    XFreePixmap(dpy, pixmap);
+
+    return cursor;
+}
+
+/**
+ * turns the status of a grab into whether we have the pointer (1), should
+ * try again after a while (0) or can't get it at all (-1)
+ */
+static int grabStatus(int rc) {
+    switch (rc) {
+        case GrabSuccess:
+            if (gVerbose) fprintf(stderr, "hhpc: succesfully grabbed mouse pointer\n");
+            return 1;
+
+        case AlreadyGrabbed:
+            if (gVerbose) fprintf(stderr, "hhpc: XGrabPointer: already grabbed mouse pointer, retrying with delay\n");
+            return 0;
+
+        case GrabFrozen:
+            if (gVerbose) fprintf(stderr, "hhpc: XGrabPointer: grab was frozen, retrying after delay\n");
+            return 0;
+
+        case GrabNotViewable:
+            fprintf(stderr, "hhpc: XGrabPointer: grab was not viewable, exiting\n");
+            return -1;
+
+        case GrabInvalidTime:
+            fprintf(stderr, "hhpc: XGrabPointer: invalid time, exiting\n");
+            return -1;
+
+        default:
+            fprintf(stderr, "hhpc: XGrabPointer: could not grab mouse pointer (%d), exiting\n", rc);
+            return -1;
+    }
+}
+
+#ifndef HAVE_XCB
+static int grabPointer(Display *dpy, Window win, Cursor cursor, unsigned int mask) {
+    int status;
+
+    /* retry until we actually get the pointer (with a suitable delay)
+     * or we get an error we can't recover from. */
+    while (working) {
+        status = grabStatus(XGrabPointer(dpy, win, True, mask, GrabModeSync, GrabModeAsync, None, cursor, CurrentTime));
+        gStats.roundtrips++;
+
+        if (status) return status > 0;
+
+        delay(0, 500);
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * the grab of the motion loop. With XCB it is only sent, and its reply is
+ * looked at once it has come in by itself or something else woke us up;
+ * until then the grab is taken to have worked
+ */
+struct pointer_grab {
+    int active;     /* grabbed, or the grab is on its way */
+    int replied;    /* the reply is in */
+    int checked;    /* and was looked at */
+    int status;
+#ifdef HAVE_XCB
+    xcb_connection_t *xcb;
+    xcb_grab_pointer_cookie_t cookie;
+#endif
+};
+
+static int grabSend(Display *dpy, Window win, Cursor cursor, unsigned int mask, struct pointer_grab *grab) {
+#ifdef HAVE_XCB
+    if (!grab->xcb) grab->xcb = XGetXCBConnection(dpy);
+
+    grab->cookie  = xcb_grab_pointer(grab->xcb, 1, win, mask, XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_ASYNC,
+                                     XCB_NONE, cursor, XCB_CURRENT_TIME);
+    grab->replied = 0;
+    grab->checked = 0;
+#else
+    if (!grabPointer(dpy, win, cursor, mask)) return 0;
+
+    grab->replied = 1;
+    grab->checked = 1;
+    grab->status  = GrabSuccess;
+#endif
+
+    grab->active = 1;
+
+    return 1;
+}
+
+/**
+ * returns whether the reply of the grab has just come in, without waiting.
+ * It may have been read off the socket along with something else, in
+ * which case the socket won't tell
+ */
+static int grabReplied(struct pointer_grab *grab) {
+#ifdef HAVE_XCB
+    xcb_grab_pointer_reply_t *reply = NULL;
+    xcb_generic_error_t *error = NULL;
+
+    if (!grab->active || grab->replied) return 0;
+
+    if (!xcb_poll_for_reply(grab->xcb, grab->cookie.sequence, (void **) &reply, &error)) return 0;
+
+    /* an error is nothing we could retry */
+    grab->status  = reply ? reply->status : -1;
+    grab->replied = 1;
+
+    free(reply);
+    free(error);
+
+    return 1;
+#else
+    (void) grab;
+
+    return 0;
+#endif
+}
+
+/**
+ * looks at the reply of the grab once it is in: 1 while the grab holds or
+ * isn't answered yet, 0 if it has to be tried again after a while, -1 if
+ * the pointer can't be had
+ */
+static int grabCheck(struct pointer_grab *grab) {
+    int status;
+
+    if (!grab->active || !grab->replied || grab->checked) return 1;
+
+    grab->checked = 1;
+
+    status = grabStatus(grab->status);
+    if (status <= 0) grab->active = 0;
+
+    return status;
+}
+
+static void waitForMotion(Display *dpy, Window win, struct refresh_ctx *refresh, long interval) {
+    int ready = 0;
+    int xfd   = ConnectionNumber(dpy);
+    int drained, status;
+    long timeout;
+
+    const unsigned int mask = PointerMotionMask | ButtonPressMask;
+
+    fd_set fds;
+    struct timeval tv;
+
+    XEvent event;
+
+    struct frame_sched sched = { 0 };
+    struct pointer_grab grab = { 0 };
+
+    sched.interval = interval;
+
+    while (working) {
+        statsPoll();
+
+        timeout = schedTimeout(&sched);
+
+        if (sched.dirty) {
+            /* the pointer is ungrabbed while we wait for the frame, whatever
+             * it does in the meantime is picked up by the refresh itself */
+            if (timeout > 0) {
+                delay(timeout / 1000, timeout % 1000);
+                continue;
+            }
+
+            statsStamp(stageIssue, 0);
+            xrefreshBegin(refresh, 0);
+            schedRefreshed(&sched);
+        }
+
+        /* with XCB the position of a refresh comes in while we wait for
+         * the pointer; a trailing check may find it where it was */
+        if (xrefreshFinish(refresh, 0)) {
+            if (gVerbose && refresh->query_moved) fprintf(stderr, "hhpc: trailing refresh\n");
+            statsFrameDone();
+            schedFinished(&sched);
+        }
+        else if (!sched.dirty && !sched.settling && !xrefreshPending(refresh) && xrefreshCleanupDue(refresh) == 0) {
+            xrefreshCleanup(refresh, 1);
+        }
+
+        /* the pointer stays grabbed until there was motion, a grab that is
+         * still on its way is just as good */
+        if (!grab.active) {
+            if (!grabSend(dpy, win, None, mask, &grab)) break;
+
+            /* we grab in sync mode, which stops pointer events from
+             * processing, so we explicitly have to re-allow it with
+             * XAllowEvents. The old method was to just grab in async mode
+             * so we wouldn't need this, but that disables replaying the
+             * pointer events */
+            XAllowEvents(dpy, SyncPointer, CurrentTime);
+        }
+
+        /* events and replies read off the socket along with something else
+         * are already queued and will never make the X11 fd ready. This
+         * used to XSync() for that, looking at the queues after a flush is
+         * enough and doesn't wait for the server */
+        if (XPending(dpy) || xrefreshReplied(refresh) || grabReplied(&grab)) {
+            ready = 1;
+        }
+        else {
+            /* add the X11 fd to the fdset so we can poll/select on it */
+            FD_ZERO(&fds);
+            FD_SET(xfd, &fds);
+
+            /* while settling, only wait until the trailing check, the
+             * cleanup or the damage is due */
+            timeout = earliest(earliest(schedTimeout(&sched), xrefreshCleanupDue(refresh)), xrefreshDamageDue(refresh));
+            tv.tv_sec  = timeout / 1000;
+            tv.tv_usec = (timeout % 1000) * 1000;
+
+            /* we poll on the X11 fd to see if an event has come in, select()
+             * is interruptible by signals, which allows ctrl+c to work. If we
+             * were to just use XNextEvent() (which blocks), ctrl+c would not
+             * work. */
+            ready = select(xfd + 1, &fds, NULL, NULL, timeout >= 0 ? &tv : NULL);
+        }
+
+        /* a grab that didn't take is tried again after a while */
+        status = grabCheck(&grab);
+        if (status < 0) break;
+        if (status == 0) {
+            delay(0, 500);
+            continue;
+        }
+
+        if (ready > 0) {
+            long long woke = monotonicUs();
+
+            /* everything queued up to now is folded into the next refresh */
+            drained = 0;
+            while (XCheckMaskEvent(dpy, mask, &event)) {
+                drained++;
+            }
+
+            /* other clients drawing wakes us up as well, that is no motion */
+            xrefreshDamageDrain(refresh);
+
+            /* nothing else is selected, but whatever is left would keep
+             * the queue from ever looking empty */
+            while (XPending(dpy)) {
+                XNextEvent(dpy, &event);
+            }
+
+            /* replies wake us up as well, only motion releases the
+             * pointer: replay event, release mouse, wait for the frame */
+            if (drained) {
+                XAllowEvents(dpy, ReplayPointer, CurrentTime);
+                XUngrabPointer(dpy, CurrentTime);
+                grab.active = 0;
+
+                statsStamp(stageInput, woke);
+                statsStamp(stageWakeup, woke);
+                gStats.wakeups++;
+                gStats.events += drained;
+                statsStamp(stageCoalesce, 0);
+
+                if (gVerbose) fprintf(stderr, "hhpc: %d event(s) received, refresh in %ld ms\n", drained, schedTimeout(&sched));
+
+                sched.dirty = 1;
+            }
+        }
+        else if (ready == 0) {
+            if (xrefreshDamageDue(refresh) == 0) xrefreshDamage(refresh);
+
+            /* woken for the damage or the cleanup, no trailing check is
+             * owed or it isn't due yet; the cleanup is taken care of at
+             * the top */
+            if (!sched.settling || schedTimeout(&sched) > 0 || xrefreshPending(refresh)) continue;
+
+            /* the pointer came to rest, make sure the place it stopped at
+             * got refreshed and not just where it was a frame ago; asking
+             * where it is gives the position to refresh at as well. The
+             * answer is taken care of at the top, with the cleanup if the
+             * pointer didn't move */
+            sched.settling = 0;
+            xrefreshBegin(refresh, 1);
+        }
+        else {
+            if (working && errno != EINTR) perror("hhpc: error while select()'ing");
+        }
+    }
+
+    XUngrabPointer(dpy, CurrentTime);
+}
+
+#ifdef HAVE_XI2
+/**
+ * selects raw motion and button events on the root window, these are
+ * delivered to every client that asks for them without anyone grabbing
+ * the pointer. returns 0 for failure, 1 for success
+ */
+static int selectRawEvents(Display *dpy, Window win, int *opcode) {
+    int event, error;
+    int major = 2, minor = 0;
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    XIEventMask evmask;
+
+    if (!XQueryExtension(dpy, "XInputExtension", opcode, &event, &error)) {
+        fprintf(stderr, "hhpc: X Input extension not available\n");
+        return 0;
+    }
+
+    if (XIQueryVersion(dpy, &major, &minor) != Success) {
+        fprintf(stderr, "hhpc: XI2 not available, server supports %d.%d\n", major, minor);
+        return 0;
+    }
+
+    XISetMask(bits, XI_RawMotion);
+    XISetMask(bits, XI_RawButtonPress);
+
+    evmask.deviceid = XIAllMasterDevices;
+    evmask.mask_len = sizeof(bits);
+    evmask.mask     = bits;
+
+    XISelectEvents(dpy, win, &evmask, 1);
+    XSync(dpy, False);
+
+    return 1;
+}
+
+/**
+ * same scheduling as waitForMotion(), but pointer activity comes in as
+ * XI2 raw events. There is no grab, so nothing is frozen, replayed or
+ * contended with other clients and no round-trip is needed per event:
+ * the X fd simply stays in the select() set the whole time.
+ */
+static void waitForRawMotion(Display *dpy, Window win, struct refresh_ctx *refresh, long interval) {
+    int ready = 0;
+    int xfd   = ConnectionNumber(dpy);
+    int opcode;
+    int drained;
+    long timeout;
+
+    fd_set fds;
+    struct timeval tv;
+
+    XEvent event;
+
+    struct frame_sched sched = { 0 };
+
+    sched.interval = interval;
+
+    if (!selectRawEvents(dpy, win, &opcode)) return;
+
+    while (working) {
+        statsPoll();
+
+        timeout = schedTimeout(&sched);
+
+        if (sched.dirty && timeout == 0 && !xrefreshPending(refresh)) {
+            statsStamp(stageIssue, 0);
+            xrefreshBegin(refresh, 0);
+            schedRefreshed(&sched);
+        }
+
+        /* the refresh goes out when its position comes in, until then
+         * events are taken as usual */
+        if (xrefreshFinish(refresh, 0)) {
+            statsFrameDone();
+            schedFinished(&sched);
+            continue;
+        }
+
+        /* the next refresh waits for this one's reply, not for the clock */
+        if (xrefreshPending(refresh)) timeout = -1;
+
+        /* events and replies already read from the socket never make the
+         * fd ready */
+        if (XPending(dpy) || xrefreshReplied(refresh)) {
+            ready = 1;
+        }
+        else {
+            FD_ZERO(&fds);
+            FD_SET(xfd, &fds);
+
+            timeout = earliest(earliest(timeout, xrefreshCleanupDue(refresh)), xrefreshDamageDue(refresh));
+            tv.tv_sec  = timeout / 1000;
+            tv.tv_usec = (timeout % 1000) * 1000;
+
+            ready = select(xfd + 1, &fds, NULL, NULL, timeout >= 0 ? &tv : NULL);
+        }
+
+        if (ready > 0) {
+            long long woke = monotonicUs();
+
+            drained = 0;
+            while (XPending(dpy)) {
+                XNextEvent(dpy, &event);
+
+                if (event.xcookie.type == GenericEvent && event.xcookie.extension == opcode &&
+                    (event.xcookie.evtype == XI_RawMotion || event.xcookie.evtype == XI_RawButtonPress)) {
+                    drained++;
+                }
+                else {
+                    xrefreshDamageEvent(refresh, &event);
+                }
+            }
+
+            if (drained) {
+                statsStamp(stageInput, woke);
+                statsStamp(stageWakeup, woke);
+                statsStamp(stageCoalesce, 0);
+                gStats.wakeups++;
+                gStats.events += drained;
+
+                if (gVerbose) fprintf(stderr, "hhpc: %d raw event(s) received, refresh in %ld ms\n", drained, schedTimeout(&sched));
+                sched.dirty = 1;
+            }
+        }
+        else if (ready == 0) {
+            if (xrefreshDamageDue(refresh) == 0) xrefreshDamage(refresh);
+
+            if (!sched.dirty && schedTimeout(&sched) <= 0 && !xrefreshPending(refresh)) {
+                /* raw events are deltas, so this is the one place the
+                 * resting position has to be asked for, a refresh there
+                 * goes out as soon as the answer is in */
+                if (sched.settling) {
+                    sched.settling = 0;
+                    if (gVerbose) fprintf(stderr, "hhpc: trailing check\n");
+                    xrefreshBegin(refresh, 1);
+                }
+                else if (xrefreshCleanupDue(refresh) == 0) {
+                    xrefreshCleanup(refresh, 1);
+                }
+            }
+        }
+        else {
+            if (working && errno != EINTR) perror("hhpc: error while select()'ing");
+        }
+    }
+}
+#endif
+
+/**
+ * opens the given event device, or looks for the merged tmouse device.
+ * returns the fd or -1
+ */
+static int openEventDevice(const char *path) {
+    char node[64];
+    char name[64];
+    int fd, i;
+
+    if (path) {
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd == -1) fprintf(stderr, "hhpc: could not open %s: %s\n", path, strerror(errno));
+        return fd;
+    }
+
+    for (i = 0; i < 32; ++i) {
+        snprintf(node, sizeof(node), "/dev/input/event%d", i);
+
+        fd = open(node, O_RDONLY | O_NONBLOCK);
+        if (fd == -1) continue;
+
+        memset(name, 0, sizeof(name));
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) != -1 && strcmp(name, "tmouse") == 0) {
+            if (gVerbose) fprintf(stderr, "hhpc: reading pointer events from %s\n", node);
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    fprintf(stderr, "hhpc: could not find the tmouse event device, is the module loaded?\n");
+
+    return -1;
+}
+
+/**
+ * A pointer position integrated from relative evdev events. Deltas are
+ * only applied once their frame is complete (SYN_REPORT), after a
+ * SYN_DROPPED everything up to the next report is thrown away and the
+ * position has to be taken from X again.
+ */
+struct evdev_pointer {
+    int x, y;
+    int dx, dy;            /* deltas of the frame being read */
+    int buttons;           /* a button changed in the frame being read */
+    int dropping;
+    int resync;            /* position is unreliable after a drop */
+    int width, height;     /* the position is clamped to the screen */
+};
+
+/**
+ * returns whether any complete frame moved the pointer or changed a button
+ */
+static int evdevFeed(struct evdev_pointer *ptr, const struct input_event *ev, int count) {
+    int changed = 0;
+    int i;
+
+    for (i = 0; i < count; ++i, ++ev) {
+        if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+            ptr->dropping = 1;
+            continue;
+        }
+
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            if (ptr->dropping) {
+                ptr->dropping = 0;
+                ptr->resync   = 1;
+                changed       = 1;
+            }
+            else if (ptr->dx || ptr->dy || ptr->buttons) {
+                /* X makes one event of a frame like this, count it the
+                 * same so the modes compare */
+                gStats.events++;
+
+                ptr->x += ptr->dx;
+                ptr->y += ptr->dy;
+
+                if (ptr->x < 0) ptr->x = 0;
+                if (ptr->y < 0) ptr->y = 0;
+                if (ptr->x >= ptr->width)  ptr->x = ptr->width - 1;
+                if (ptr->y >= ptr->height) ptr->y = ptr->height - 1;
+
+                changed = 1;
+            }
+
+            ptr->dx = ptr->dy = ptr->buttons = 0;
+            continue;
+        }
+
+        if (ptr->dropping) continue;
+
+        if (ev->type == EV_REL && ev->code == REL_X) ptr->dx += ev->value;
+        else if (ev->type == EV_REL && ev->code == REL_Y) ptr->dy += ev->value;
+        else if (ev->type == EV_KEY) ptr->buttons = 1;
+    }
+
+    return changed;
+}
+
+static void evdevSync(struct evdev_pointer *ptr, Display *dpy, Window win) {
+    int win_x, win_y;
+    unsigned int query_mask;
+    Window child_win, root_win;
+
+    XQueryPointer(dpy, win, &child_win, &root_win, &ptr->x, &ptr->y, &win_x, &win_y, &query_mask);
+    gStats.roundtrips++;
+
+    ptr->resync = 0;
+}
+
+/**
+ * same scheduling as waitForMotion(), but the pointer is read straight from
+ * the tmouse event device: no grab and no X server on the input path. The
+ * integrated position has none of X's acceleration, so it is brought back
+ * in line with the X pointer once the pointer comes to rest.
+ */
+static void waitForEvdev(Display *dpy, Window win, struct refresh_ctx *refresh, long interval) {
+    struct input_event events[64];
+    struct epoll_event ev;
+    struct evdev_pointer ptr = { 0 };
+    struct frame_sched sched = { 0 };
+    long timeout;
+    ssize_t len;
+    int fd, epfd, ready;
+    int xfd = ConnectionNumber(dpy);
+    XEvent event;
+
+    sched.interval = interval;
+
+    fd = openEventDevice(gEventDevice);
+    if (fd == -1) return;
+
+    epfd = epoll_create(1);
+    if (epfd == -1) {
+        perror("hhpc: epoll_create");
+        close(fd);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("hhpc: epoll_ctl");
+        close(epfd);
+        close(fd);
+        return;
+    }
+
+    /* X has damage and the answers to the trailing checks to tell */
+    ev.data.fd = xfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, xfd, &ev) == -1) {
+        perror("hhpc: epoll_ctl");
+        close(epfd);
+        close(fd);
+        return;
+    }
+
+    ptr.width  = DisplayWidth(dpy, DefaultScreen(dpy));
+    ptr.height = DisplayHeight(dpy, DefaultScreen(dpy));
+    evdevSync(&ptr, dpy, win);
+
+    while (working) {
+        statsPoll();
+
+        timeout = schedTimeout(&sched);
+
+        if (sched.dirty && timeout == 0) {
+            statsStamp(stageIssue, 0);
+            if (ptr.resync) evdevSync(&ptr, dpy, win);
+
+            /* the pointer moved on since the trailing check asked */
+            xrefreshCancel(refresh);
+            xrefreshAt(refresh, ptr.x, ptr.y);
+            statsFrameDone();
+            schedRefreshed(&sched);
+            continue;
+        }
+
+        /* the answer to the trailing check brings the integrated position
+         * back in line with the X pointer, unless it moved on since */
+        if (!sched.dirty && xrefreshPending(refresh) && xrefreshReplied(refresh)) {
+            ptr.x      = refresh->query_x;
+            ptr.y      = refresh->query_y;
+            ptr.resync = 0;
+
+            if (xrefreshFinish(refresh, 0)) {
+                if (gVerbose) fprintf(stderr, "hhpc: trailing refresh\n");
+                statsFrameDone();
+                schedFinished(&sched);
+            }
+            else if (xrefreshCleanupDue(refresh) == 0) {
+                xrefreshCleanup(refresh, 1);
+            }
+        }
+
+        /* replies read along the way may have brought events with them,
+         * which will never make the X11 fd ready */
+        if (XPending(dpy) || (!sched.dirty && xrefreshReplied(refresh))) {
+            ready = 1;
+            ev.data.fd = xfd;
+        }
+        else {
+            timeout = earliest(earliest(timeout, xrefreshCleanupDue(refresh)), xrefreshDamageDue(refresh));
+            ready = epoll_wait(epfd, &ev, 1, timeout);
+        }
+
+        if (ready > 0 && ev.data.fd == xfd) {
+            /* nothing but damage is selected, whatever else there is would
+             * keep the fd ready forever */
+            while (XPending(dpy)) {
+                XNextEvent(dpy, &event);
+                xrefreshDamageEvent(refresh, &event);
+            }
+        }
+        else if (ready > 0) {
+            statsStamp(stageWakeup, 0);
+            gStats.wakeups++;
+
+            /* read everything that is there, a whole batch per syscall */
+            while ((len = read(fd, events, sizeof(events))) > 0) {
+                statsStamp(stageInput, eventTimeUs(&events[0].time));
+                if (evdevFeed(&ptr, events, len / sizeof(events[0]))) sched.dirty = 1;
+            }
+
+            if (sched.dirty) {
+                statsStamp(stageCoalesce, 0);
+            }
+            else {
+                /* nothing but partial frames, not a frame of its own yet */
+                memset(gStats.stamp, 0, sizeof(gStats.stamp));
+            }
+
+            if (len == -1 && errno != EAGAIN && errno != EINTR) {
+                perror("hhpc: reading the event device");
+                break;
+            }
+        }
+        else if (ready == 0) {
+            if (xrefreshDamageDue(refresh) == 0) xrefreshDamage(refresh);
+
+            if (!sched.dirty && schedTimeout(&sched) <= 0 && !xrefreshPending(refresh)) {
+                sched.settling = 0;
+
+                /* only a centered refresh follows the pointer, a fixed
+                 * area never records where it is. The answer is taken
+                 * care of at the top, with the cleanup if the pointer
+                 * didn't move */
+                if (refresh->centered) {
+                    xrefreshBegin(refresh, 1);
+                }
+                else if (xrefreshCleanupDue(refresh) == 0) {
+                    xrefreshCleanup(refresh, 1);
+                }
+            }
+        }
+        else {
+            if (working && errno != EINTR) perror("hhpc: error while epoll_wait()'ing");
+        }
+    }
+
+    close(epfd);
+    close(fd);
+}
+
+static int parseOptions(int argc, char *argv[]) {
+    int option = 0;
+
+    int rate;
+
+    while ((option = getopt(argc, argv, "a:b:c:d:e:f:g:G:i:m:n:p:r:s:S:v")) != -1) {
+        switch (option) {
+            case 'S': gStatsFile = optarg; break;
+            case 'e': gEventDevice = optarg; break;
+            case 'a': gAlign = atoi(optarg); break;
+            case 'b': gBackend = optarg; break;
+            case 'c': gCursorFont = optarg; break;
+#ifdef HAVE_XDAMAGE
+            case 'd': gDamageInterval = atol(optarg); break;
+#endif
+            case 'f': gDevice = optarg; break;
+            case 'g': gGhostLimit = atoi(optarg); break;
+            case 'G': gGhostIdle = atol(optarg); break;
+            case 'n': gMaxRects = atoi(optarg); break;
+            case 'p': gPredictLead = atol(optarg); break;
+            case 'm':
+                if (strcmp(optarg, "grab") == 0) gInput = inputGrab;
+                else if (strcmp(optarg, "evdev") == 0) gInput = inputEvdev;
+#ifdef HAVE_XI2
+                else if (strcmp(optarg, "xi2") == 0) gInput = inputXI2;
+#endif
+                else return 0;
+                break;
+            case 'i': gFrameInterval = atoi(optarg) * 1000L; break;
+            case 'r':
+                rate = atoi(optarg);
+                if (rate <= 0) return 0;
+                gFrameInterval = 1000 / rate;
+                break;
+            case 's': gRefreshSize = atoi(optarg); break;
+            case 'v': gVerbose = 1; break;
+            default: return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void usage() {
+    printf("hhpc [-a pixels] [-b backend] [-c font.pcf] [-d ms] [-e device] [-f device] [-g updates] [-G ms] [-i seconds] [-m mode] [-n rects] [-p ms] [-r hz] [-s pixels] [-S file] [-v]\n");
+    printf("    -a  alignment of refreshed areas, the default is 8\n");
+    printf("    -b  how to refresh: x (map a window, the default), fb (framebuffer\n");
+    printf("        partial updates) or fake (a file standing in for the framebuffer)\n");
+    printf("    -c  draw the cursor from this cursor font (big-cursor.pcf) into the\n");
+    printf("        framebuffer, needs the fb or fake backend and -s above 0\n");
+#ifndef HAVE_XFIXES
+    printf("        (without HAVE_XFIXES, windows with a cursor of their own still show it)\n");
+#endif
+#ifdef HAVE_XDAMAGE
+    printf("    -d  also refresh what other clients draw, at most every this many milliseconds\n");
+#else
+    printf("    -d  also refresh what other clients draw (needs HAVE_XDAMAGE)\n");
+#endif
+    printf("    -e  event device for -m evdev, the tmouse device by default\n");
+    printf("    -f  framebuffer device or file, /dev/fb0 and hhpc-fakefb by default\n");
+    printf("    -g  refresh fast moves with the quickest waveform and clean up the ghosting\n");
+    printf("        once the pointer rests, or after this many fast updates of an area\n");
+    printf("    -G  milliseconds of rest before the cleanup, the default is 1000\n");
+    printf("    -i  seconds between refreshes\n");
+#ifdef HAVE_XI2
+    printf("    -m  how to track the pointer: grab (the default), xi2 or evdev\n");
+#else
+    printf("    -m  how to track the pointer: grab (the default) or evdev (xi2 needs HAVE_XI2)\n");
+#endif
+    printf("    -n  most areas refreshed per frame before they are merged into one, the default is 4\n");
+    printf("    -p  also refresh where the pointer is headed, this many milliseconds ahead,\n");
+    printf("        about how long the panel takes to show a refresh\n");
+    printf("    -r  refreshes per second, the default is 5\n");
+    printf("    -s  size of the area refreshed around the pointer, 0 for the whole screen\n");
+    printf("    -S  write latency stats to this file every %ld seconds, they go to\n", gStatsPeriod);
+    printf("        stderr on SIGUSR1 otherwise\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (!parseOptions(argc, argv)) {
+        usage();
+
+        return 1;
+    }
+
+    char *displayName = getenv("DISPLAY");
+
+    Display *dpy = XOpenDisplay(NULL);
+    if (!dpy) {
+        if (!displayName || strlen(displayName) == 0) {
+            fprintf(stderr, "hhpc: could not open display, DISPLAY environment variable not set, are you sure the X server is started?\n");
+            return 2;
+        }
+        else {
+            fprintf(stderr, "hhpc: could not open display %s, check if your X server is running and/or the DISPLAY environment value is correct\n", displayName);
+            return 1;
+        }
+    }
+
+    gStats.dpy = dpy;
+
+    int scr        = DefaultScreen(dpy);
+    Window rootwin = RootWindow(dpy, scr);
+
+    if (gVerbose) fprintf(stderr, "hhpc: got root window, screen = %d, display = %p, rootwin = %d\n", scr, (void *) dpy, (int) rootwin);
+
+    /* a bare WxH geometry makes xrefresh() center the area on the pointer,
+     * no geometry at all refreshes the whole screen */
+    char geometry[32] = { 0 };
+    struct refresh_ctx refresh;
+    struct sw_cursor cursor;
+    Cursor hidden = None;
+    int hiddenAll = 0;
+    int status = 1;
+
+    if (gRefreshSize > 0) {
+        sprintf(geometry, "%dx%d", gRefreshSize, gRefreshSize);
+    }
+
+    const struct refresh_backend *backend = findBackend(gBackend);
+
+    if (!backend) {
+        fprintf(stderr, "hhpc: unknown refresh backend %s\n", gBackend);
+        goto close;
+    }
+
+    if (!xrefreshInit(&refresh, dpy, backend, gDevice, "pointer.lix", gRefreshSize > 0 ? geometry : NULL, doDefault, NULL)) {
+        fprintf(stderr, "hhpc: could not set up the %s refresh backend\n", backend->name);
+        goto close;
+    }
+
+    if (gCursorFont) {
+        if (!refresh.fb.base || refresh.fb.bpp != 8) {
+            fprintf(stderr, "hhpc: a software cursor needs an 8 bpp fb or fake backend\n");
+            goto destroy;
+        }
+
+        /* the cursor is drawn into the area around the pointer, a fixed
+         * area would leave it invisible */
+        if (!refresh.centered) {
+            fprintf(stderr, "hhpc: a software cursor needs an area around the pointer, -s can't be 0\n");
+            goto destroy;
+        }
+
+        if (!cursorLoad(&cursor, gCursorFont, XC_left_ptr)) goto destroy;
+
+        refresh.cursor = &cursor;
+
+        /* X must not draw its own cursor on top of ours, XFixes hides it
+         * everywhere, an invisible cursor on the root only where no window
+         * defines its own */
+#ifdef HAVE_XFIXES
+        int eventBase, errorBase, major = 4, minor = 0;
+
+        if (XFixesQueryExtension(dpy, &eventBase, &errorBase) && XFixesQueryVersion(dpy, &major, &minor) && major >= 4) {
+            XFixesHideCursor(dpy, rootwin);
+            hiddenAll = 1;
+        }
+#endif
+        if (!hiddenAll) {
+            hidden = nullCursor(dpy, rootwin);
+            XDefineCursor(dpy, rootwin, hidden);
+        }
+    }
+
+    working = 1;
+
+    if (!setupSignals()) {
+        fprintf(stderr, "hhpc: could not register signals, program will not exit cleanly\n");
+    }
+
+    switch (gInput) {
+        case inputGrab: waitForMotion(dpy, rootwin, &refresh, gFrameInterval); break;
+        case inputEvdev: waitForEvdev(dpy, rootwin, &refresh, gFrameInterval); break;
+#ifdef HAVE_XI2
+        case inputXI2: waitForRawMotion(dpy, rootwin, &refresh, gFrameInterval); break;
+#endif
+        default: break;
+    }
+
+    status = 0;
+
+    /* whatever got set up, in reverse; the refresh takes the cursor off
+     * the screen before it is freed */
+destroy:
+    xrefreshDestroy(&refresh);
+
+    if (refresh.cursor) {
+        cursorFree(&cursor);
+#ifdef HAVE_XFIXES
+        if (hiddenAll) XFixesShowCursor(dpy, rootwin);
+#endif
+        if (hidden != None) {
+            XUndefineCursor(dpy, rootwin);
+            XFreeCursor(dpy, hidden);
+        }
+    }
+
+close:
+    XCloseDisplay(dpy);
+
+    return status;
+}
+
+char *ProgramName;
+
+static void 
+Syntax(void)
+{
+    fprintf (stderr, "usage:  %s [-options] [geometry] [display]\n\n", 
+    	     ProgramName);
+    fprintf (stderr, "where the available options are:\n");
+    fprintf (stderr, "    -display host:dpy       or -d\n");
+    fprintf (stderr, "    -geometry WxH+X+Y       or -g spec\n");
+    fprintf (stderr, "    -black                  use BlackPixel\n");
+    fprintf (stderr, "    -white                  use WhitePixel\n");
+    fprintf (stderr, "    -solid colorname        use the color indicated\n");
+    fprintf (stderr, "    -root                   use the root background\n");
+    fprintf (stderr, "    -none                   no background in window\n");
+    fprintf (stderr, "\nThe default is:  %s -none\n\n", ProgramName);
+    exit (1);
+}
+
+/*
+ * The following parses options that should be yes or no; it returns -1, 0, 1
+ * for error, no, yes.
+ */
+
+static int 
+parse_boolean_option(char *option)
+{
+    static struct _booltable {
+        char *name;
+        int value;
+    } booltable[] = {
+        { "off", 0 }, { "n", 0 }, { "no", 0 }, { "false", 0 },
+        { "on", 1 }, { "y", 1 }, { "yes", 1 }, { "true", 1 },
+        { NULL, -1 }};
+    register struct _booltable *t;
+    register char *cp;
+
+    for (cp = option; *cp; cp++) {
+        if (isascii (*cp) && isupper (*cp)) *cp = tolower (*cp);
+    }
+
+    for (t = booltable; t->name; t++) {
+        if (strcmp (option, t->name) == 0) return (t->value);
+    }
+    return (-1);
+}
+
+
+/*
+ * The following is a hack until XrmParseCommand is ready.  It determines
+ * whether or not the given string is an abbreviation of the arg.
+ */
+
+static Bool 
+isabbreviation(char *arg, char *s, int minslen)
+{
+    int arglen;
+    int slen;
+
+    /* exact match */
+    if (strcmp (arg, s) == 0) return (True);
+
+    arglen = strlen (arg);
+    slen = strlen (s);
+
+    /* too long or too short */
+    if (slen >= arglen || slen < minslen) return (False);
+
+    /* abbreviation */
+    if (strncmp (arg, s, slen) == 0) return (True);
+
+    /* bad */
+    return (False);
+}
+
+struct s_pair {
+	char *resource_name;
+	enum e_action action;
+} pair_table[] = {
+	{ "Black", doBlack },
+	{ "White", doWhite },
+	{ "None", doNone },
+	{ "Root", doRoot },
+	{ NULL, doDefault }};
+
+/*
+ * Sets up everything a refresh needs once: resolves the action and colors
+ * from the resource database, parses the geometry and creates the
+ * override-redirect window. xrefresh() then only has to move and
+ * map/unmap that window, instead of redoing all of this (and several
+ * round-trips) for every pointer event. Returns 0 for failure, 1 for
+ * success.
+ */
+int
+xrefreshInit(struct refresh_ctx *ctx, Display *dpy, const struct refresh_backend *backend, const char *device, char *ProgramName, char *geom, enum e_action action, char *solidcolor)
+{
+    XSetWindowAttributes xswa;
+    Colormap cmap;
+    unsigned long mask;
+    int screen;
+    int x, y, width, height;
+    int geom_result;
+    int display_width, display_height;
+    XColor cdef;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->dpy = dpy;
+    ctx->backend = backend;
+    ctx->device = device;
+    ctx->fb.fd = -1;
+
+    if (action == doDefault) {
+	char *def;
+
+	if ((def = XGetDefault (dpy, ProgramName, "Solid")) != NULL) {
+	    solidcolor = ctx->solidcolor = strdup (def);
+	    if (solidcolor == NULL) {
 		fprintf (stderr,
 			 "%s:  unable to allocate memory for string.\n",
 			 ProgramName);
@@ -415,132 +2247,921 @@ int win_x, win_y, root_x, root_y = 0;
 	} else {
 	    struct s_pair *pp;
 
-	    for (pp = pair_table; pp->resource_name != NULL; pp++) {
-		def = XGetDefault (dpy, ProgramName, pp->resource_name);
-		if (def && parse_boolean_option (def) == 1) {
-		    action = pp->action;
-		}
+	    for (pp = pair_table; pp->resource_name != NULL; pp++) {
+		def = XGetDefault (dpy, ProgramName, pp->resource_name);
+		if (def && parse_boolean_option (def) == 1) {
+		    action = pp->action;
+		}
+	    }
+	}
+    }
+
+    if (geom == NULL) geom = XGetDefault (dpy, ProgramName, "Geometry");
+
+    screen = DefaultScreen (dpy);
+    display_width = DisplayWidth (dpy, screen);
+    display_height = DisplayHeight (dpy, screen);
+    x = y = 0; 
+    width = display_width;
+    height = display_height;
+
+    if (DisplayCells (dpy, screen) <= 2 && action == doSolid) {
+	if (strcmp (solidcolor, "black") == 0)
+	    action = doBlack;
+	else if (strcmp (solidcolor, "white") == 0) 
+	    action = doWhite;
+	else {
+	    fprintf (stderr, 
+	    	     "%s:  can't use colors on a monochrome display.\n",
+		     ProgramName);
+	    action = doNone;
+	}
+    }
+
+    if (geom) 
+        geom_result = XParseGeometry (geom, &x, &y,
+				      (unsigned int *)&width,
+				      (unsigned int *)&height);
+    else
+	geom_result = NoValue;
+
+    /*
+     * For parsing geometry, we want to have the following
+     *     
+     *     =                (0,0) for (display_width,display_height)
+     *     =WxH+X+Y         (X,Y) for (W,H)
+     *     =WxH-X-Y         (display_width-W-X,display_height-H-Y) for (W,H)
+     *     =+X+Y            (X,Y) for (display_width-X,display_height-Y)
+     *     =WxH             (0,0) for (W,H)
+     *     =-X-Y            (0,0) for (display_width-X,display_height-Y)
+     *
+     * If we let any missing values be taken from (0,0) for 
+     * (display_width,display_height) we just have to deal with the
+     * negative offsets.
+     */
+
+    if (geom_result & XNegative) {
+	if (geom_result & WidthValue) {
+	    x = display_width - width + x;
+	} else {
+	    width = display_width + x;
+	    x = 0;
+	}
+    } 
+    if (geom_result & YNegative) {
+	if (geom_result & HeightValue) {
+	    y = display_height - height + y;
+	} else {
+	    height = display_height + y;
+	    y = 0;
+	}
+    }
+
+    mask = 0;
+    switch (action) {
+	case doBlack:
+	    xswa.background_pixel = BlackPixel (dpy, screen);
+	    mask |= CWBackPixel;
+	    break;
+	case doWhite:
+	    xswa.background_pixel = WhitePixel (dpy, screen);
+	    mask |= CWBackPixel;
+	    break;
+	case doSolid:
+	    cmap = DefaultColormap (dpy, screen);
+	    if (XParseColor (dpy, cmap, solidcolor, &cdef) &&
+		XAllocColor (dpy, cmap, &cdef)) {
+		xswa.background_pixel = cdef.pixel;
+		mask |= CWBackPixel;
+	    } else {
+		fprintf (stderr,"%s:  unable to allocate color '%s'.\n",
+			 ProgramName, solidcolor);
+		action = doNone;
+	    }
+	    break;
+	case doDefault:
+	case doNone:
+	    xswa.background_pixmap = None;
+	    mask |= CWBackPixmap;
+	    break;
+	case doRoot:
+	    xswa.background_pixmap = ParentRelative;
+	    mask |= CWBackPixmap;
+	    break;
+    }
+    xswa.override_redirect = True;
+    xswa.backing_store = NotUseful;
+    xswa.save_under = False;
+    mask |= (CWOverrideRedirect | CWBackingStore | CWSaveUnder);
+
+    /*
+     * A geometry with only a size is taken relative to the pointer: the
+     * area is centered on it and clamped so it stays on the screen. This
+     * keeps the e-ink update down to the few pixels around the cursor
+     * instead of flashing the whole panel on every move.
+     */
+    ctx->centered = (geom_result & (WidthValue | HeightValue)) &&
+                    !(geom_result & (XValue | YValue));
+
+    if (width > display_width) width = display_width;
+    if (height > display_height) height = display_height;
+
+    ctx->screen = screen;
+    ctx->root = RootWindow (dpy, screen);
+    ctx->display_width = display_width;
+    ctx->display_height = display_height;
+    ctx->x = x;
+    ctx->y = y;
+    ctx->width = width;
+    ctx->height = height;
+
+    ctx->xswa = xswa;
+    ctx->xswa_mask = mask;
+    ctx->pointer_x = ctx->pointer_y = -1;
+
+#ifdef HAVE_XCB
+    ctx->xcb = XGetXCBConnection(dpy);
+#endif
+
+    dirtyInit(&ctx->dirty, display_width, display_height, gAlign, gMaxRects);
+    dirtyInit(&ctx->damage, display_width, display_height, gAlign, gMaxRects);
+    motionInit(&ctx->motion, gPredictLead, gFrameInterval);
+
+    if (!ghostInit (&ctx->ghost, display_width, display_height, gGhostLimit, gGhostIdle)) {
+	fprintf (stderr, "hhpc: no memory for the ghosting map\n");
+	goto fail;
+    }
+
+#ifdef HAVE_XDAMAGE
+    if (gDamageInterval > 0) {
+	int error_base;
+
+	if (!XDamageQueryExtension (dpy, &ctx->damage_event, &error_base)) {
+	    fprintf (stderr, "hhpc: X Damage extension not available\n");
+	    goto fail;
+	}
+
+	/* raw rectangles need no XDamageSubtract() round-trip to re-arm */
+	ctx->damage_event += XDamageNotify;
+	ctx->damage_handle = XDamageCreate (dpy, ctx->root, XDamageReportRawRectangles);
+	ctx->damage_interval = gDamageInterval;
+    }
+#endif
+
+    if (backend->init (ctx)) return 1;
+
+    /* undo whatever was set up, in reverse; a ghost map that failed to
+     * set up is empty and freeing it does nothing */
+fail:
+#ifdef HAVE_XDAMAGE
+    if (ctx->damage_handle) XDamageDestroy (ctx->dpy, ctx->damage_handle);
+    ctx->damage_handle = 0;
+    ctx->damage_interval = 0;
+#endif
+
+    ghostFree (&ctx->ghost);
+    free (ctx->solidcolor);
+    ctx->solidcolor = NULL;
+
+    return 0;
+}
+
+void
+xrefreshDestroy(struct refresh_ctx *ctx)
+{
+    if (ctx->cursor && ctx->cursor->shown) {
+	cursorHide (ctx->cursor, &ctx->fb);
+	ctx->backend->update (ctx, &ctx->cursor->drawn, waveAuto);
+    }
+
+#ifdef HAVE_XDAMAGE
+    if (ctx->damage_handle) XDamageDestroy (ctx->dpy, ctx->damage_handle);
+    ctx->damage_handle = 0;
+#endif
+
+    ctx->backend->destroy(ctx);
+    ghostFree (&ctx->ghost);
+    free (ctx->solidcolor);
+
+    ctx->win = None;
+    ctx->solidcolor = NULL;
+}
+
+void
+xrefresh(struct refresh_ctx *ctx)
+{
+    xrefreshBegin (ctx, 0);
+    xrefreshFinish (ctx, 1);
+}
+
+/*
+ * Starts a refresh at wherever the pointer is. With XCB the position is
+ * only asked for here, and the refresh waits in xrefreshFinish() until
+ * the reply is in, so the caller can get on with other things instead of
+ * stalling while the server is busy. With moved set, the refresh is
+ * skipped if the pointer is still where it was, which is the trailing
+ * check; only a centered refresh follows the pointer, a fixed area
+ * never moves.
+ */
+void
+xrefreshBegin(struct refresh_ctx *ctx, int moved)
+{
+#ifndef HAVE_XCB
+    int win_x, win_y;
+    unsigned int query_mask = 0;
+    Window child_win, root_win;
+#endif
+
+    /* a refresh still waiting for its position is superseded */
+    xrefreshCancel (ctx);
+
+    ctx->query_pending = 1;
+    ctx->query_ready = 1;
+    ctx->query_moved = moved;
+    ctx->query_x = ctx->query_y = 0;
+
+    if (!ctx->centered) return;
+
+#ifdef HAVE_XCB
+    ctx->query_cookie = xcb_query_pointer (ctx->xcb, ctx->root);
+    ctx->query_ready = 0;
+    xcb_flush (ctx->xcb);
+#else
+    XQueryPointer(ctx->dpy, ctx->root,
+		  &child_win, &root_win,
+		  &ctx->query_x, &ctx->query_y, &win_x, &win_y, &query_mask);
+    gStats.roundtrips++;
+#endif
+}
+
+/*
+ * Forgets a started refresh, for when the pointer has moved on since and
+ * its position would be stale.
+ */
+void
+xrefreshCancel(struct refresh_ctx *ctx)
+{
+#ifdef HAVE_XCB
+    if (ctx->query_pending && !ctx->query_ready)
+	xcb_discard_reply (ctx->xcb, ctx->query_cookie.sequence);
+#endif
+
+    ctx->query_pending = 0;
+}
+
+/*
+ * Returns whether a refresh was started and not finished yet.
+ */
+int
+xrefreshPending(struct refresh_ctx *ctx)
+{
+    return ctx->query_pending;
+}
+
+/*
+ * Returns whether a started refresh has its position, without waiting.
+ * The reply may have been read off the socket along with something else,
+ * in which case the socket won't tell.
+ */
+int
+xrefreshReplied(struct refresh_ctx *ctx)
+{
+#ifdef HAVE_XCB
+    xcb_query_pointer_reply_t *reply = NULL;
+    xcb_generic_error_t *error = NULL;
+
+    if (!ctx->query_pending || ctx->query_ready) return ctx->query_pending;
+
+    if (!xcb_poll_for_reply (ctx->xcb, ctx->query_cookie.sequence, (void **) &reply, &error))
+	return 0;
+
+    /* without an answer, the pointer is taken to be where it was */
+    ctx->query_x = reply ? reply->root_x : ctx->pointer_x;
+    ctx->query_y = reply ? reply->root_y : ctx->pointer_y;
+    ctx->query_ready = 1;
+
+    free (reply);
+    free (error);
+#endif
+
+    return ctx->query_pending;
+}
+
+/*
+ * Refreshes for the position a started refresh asked for, once it is in,
+ * or waiting for it with wait set. Returns 1 if something was refreshed,
+ * 0 if the position isn't in yet, nothing was started or the trailing
+ * check found the pointer where it was.
+ */
+int
+xrefreshFinish(struct refresh_ctx *ctx, int wait)
+{
+#ifdef HAVE_XCB
+    xcb_query_pointer_reply_t *reply;
+
+    if (ctx->query_pending && !ctx->query_ready && wait) {
+	reply = xcb_query_pointer_reply (ctx->xcb, ctx->query_cookie, NULL);
+	gStats.roundtrips++;
+
+	ctx->query_x = reply ? reply->root_x : ctx->pointer_x;
+	ctx->query_y = reply ? reply->root_y : ctx->pointer_y;
+	ctx->query_ready = 1;
+
+	free (reply);
+    }
+#endif
+
+    if (!xrefreshReplied (ctx) || !ctx->query_ready) return 0;
+
+    ctx->query_pending = 0;
+
+    if (ctx->query_moved &&
+	(!ctx->centered || (ctx->query_x == ctx->pointer_x && ctx->query_y == ctx->pointer_y)))
+	return 0;
+
+    xrefreshAt (ctx, ctx->query_x, ctx->query_y);
+
+    return 1;
+}
+
+/*
+ * Hands every rectangle of the frame in dirty to the backend, picking the
+ * waveform for each: in a fast frame a rectangle gets the fast one unless
+ * it carries what other clients drew, which deserves the quality. Only
+ * fast updates leave ghosting to be counted.
+ */
+static void
+xrefreshRegion(struct refresh_ctx *ctx, struct dirty_region *dirty, int fast)
+{
+    enum e_waveform wave;
+    int i, j;
+
+    ctx->echo_count = 0;
+
+    for (i = 0; i < dirty->count; i++) {
+	wave = fast ? waveFast : waveAuto;
+	for (j = 0; wave == waveFast && j < ctx->damage.count; j++) {
+	    if (rectTouches (&dirty->rects[i], &ctx->damage.rects[j])) wave = waveAuto;
+	}
+
+	ctx->backend->update (ctx, &dirty->rects[i], wave);
+	gStats.pixels += rectArea (&dirty->rects[i]);
+
+	if (wave == waveFast) {
+	    ghostMark (&ctx->ghost, &dirty->rects[i]);
+	    gStats.fast++;
+	}
+    }
+    gStats.rects += dirty->count;
+}
+
+/*
+ * Refreshes for a pointer at root_x,root_y, for when the position is
+ * already known and asking the server for it would be a wasted round-trip.
+ */
+void
+xrefreshAt(struct refresh_ctx *ctx, int root_x, int root_y)
+{
+    struct dirty_region *dirty = &ctx->dirty;
+    struct rect box, ahead;
+    int fast = 0;
+    int next_x, next_y;
+    int i;
+
+    box.x = ctx->x;
+    box.y = ctx->y;
+    box.width = ctx->width;
+    box.height = ctx->height;
+
+    dirty->count = 0;
+
+    if (ctx->centered) {
+	if (gVerbose) fprintf (stderr, "hhpc: root_x = %d, root_y = %d\n",
+			       root_x, root_y);
+
+	box.x = root_x - ctx->width / 2;
+	box.y = root_y - ctx->height / 2;
+
+	/*
+	 * a cursor we draw ourselves only ever occupies its own box, and
+	 * only at the positions we drew it at
+	 */
+	if (ctx->cursor) {
+	    cursorHide (ctx->cursor, &ctx->fb);
+	    cursorShow (ctx->cursor, &ctx->fb, root_x, root_y);
+	    cursorBox (ctx->cursor, root_x, root_y, &box);
+	}
+
+	/*
+	 * the old box erases the cursor where it was, the path covers
+	 * where it went while the refresh was held back
+	 */
+	if (ctx->pointer_x >= 0) {
+	    /*
+	     * a jump of more than half the area is a fast move, it is
+	     * worth the ghosting that gets cleaned up later
+	     */
+	    if (ctx->ghost.limit &&
+		(abs (root_x - ctx->pointer_x) > ctx->width / 2 ||
+		 abs (root_y - ctx->pointer_y) > ctx->height / 2))
+		fast = 1;
+
+	    dirtyAdd (dirty, &ctx->box);
+	    if (!ctx->cursor) {
+		dirtyAddPath (dirty, ctx->pointer_x, ctx->pointer_y,
+			      root_x, root_y, ctx->width, ctx->height);
 	    }
 	}
+
+	/*
+	 * X moves its cursor on its own while the refresh is still on the
+	 * way to the panel, so refresh ahead along where it is going too;
+	 * a cursor we draw stays where we drew it
+	 */
+	motionAdd (&ctx->motion, root_x, root_y, monotonicUs ());
+	if (!ctx->cursor &&
+	    motionPredict (&ctx->motion, ctx->width, ctx->height, &next_x, &next_y)) {
+	    if (gVerbose) fprintf (stderr, "hhpc: predicted %d,%d\n", next_x, next_y);
+	    dirtyAddPath (dirty, root_x, root_y, next_x, next_y,
+			  ctx->width, ctx->height);
+
+	    ahead.x = next_x - ctx->width / 2;
+	    ahead.y = next_y - ctx->height / 2;
+	    ahead.width = ctx->width;
+	    ahead.height = ctx->height;
+	    dirtyAdd (dirty, &ahead);
+	}
+
+	ctx->pointer_x = root_x;
+	ctx->pointer_y = root_y;
+	ctx->box = box;
     }
 
-    if (geom == NULL) geom = XGetDefault (dpy, ProgramName, "Geometry");
+    dirtyAdd (dirty, &box);
 
-    screen = DefaultScreen (dpy);
-    display_width = DisplayWidth (dpy, screen);
-    display_height = DisplayHeight (dpy, screen);
-    x = y = 0; 
-    width = display_width;
-    height = display_height;
+    /*
+     * what other clients drew meanwhile goes along, at the quality
+     * their content deserves rather than the pointer's
+     */
+    for (i = 0; i < ctx->damage.count; i++) {
+	dirtyAdd (dirty, &ctx->damage.rects[i]);
+    }
 
-    if (DisplayCells (dpy, screen) <= 2 && action == doSolid) {
-	if (strcmp (solidcolor, "black") == 0)
-	    action = doBlack;
-	else if (strcmp (solidcolor, "white") == 0) 
-	    action = doWhite;
-	else {
-	    fprintf (stderr, 
-	    	     "%s:  can't use colors on a monochrome display.\n",
-		     ProgramName);
-	    action = doNone;
-	}
+    xrefreshRegion (ctx, dirty, fast);
+
+    if (ctx->damage.count) {
+	ctx->damage.count = 0;
+	clock_gettime (CLOCK_MONOTONIC, &ctx->damage_last);
     }
 
-    if (geom) 
-        geom_result = XParseGeometry (geom, &x, &y,
-				      (unsigned int *)&width,
-				      (unsigned int *)&height);
-    else
-	geom_result = NoValue;
+    /* an area that has taken too many can't wait for the pointer to rest */
+    if (ctx->ghost.over) xrefreshCleanup (ctx, ctx->ghost.limit);
+
+    /* nothing else flushes the X backend's requests in the xi2 and evdev modes */
+    XFlush (ctx->dpy);
+}
+
+/*
+ * Milliseconds until the ghosting left by partial updates is due to be
+ * cleaned up, -1 if there is none.
+ */
+long
+xrefreshCleanupDue(struct refresh_ctx *ctx)
+{
+    long left;
+
+    if (!ctx->ghost.limit || !ctx->ghost.pending) return -1;
+
+    left = ctx->ghost.idle - elapsedMs (&ctx->ghost.last);
+
+    return left > 0 ? left : 0;
+}
+
+/*
+ * Cleans every area that took at least min partial updates with a full
+ * quality one, merged the same way as any other frame.
+ */
+void
+xrefreshCleanup(struct refresh_ctx *ctx, int min)
+{
+    int count, i;
+
+    if (!ctx->ghost.limit) return;
 
     /*
-     * For parsing geometry, we want to have the following
-     *     
-     *     =                (0,0) for (display_width,display_height)
-     *     =WxH+X+Y         (X,Y) for (W,H)
-     *     =WxH-X-Y         (display_width-W-X,display_height-H-Y) for (W,H)
-     *     =+X+Y            (X,Y) for (display_width-X,display_height-Y)
-     *     =WxH             (0,0) for (W,H)
-     *     =-X-Y            (0,0) for (display_width-X,display_height-Y)
-     *
-     * If we let any missing values be taken from (0,0) for 
-     * (display_width,display_height) we just have to deal with the
-     * negative offsets.
+     * tile by tile rather than through a dirty region, which would fold
+     * a long diagonal drag into a flash of most of the screen
      */
+    count = ghostCollect (&ctx->ghost, min);
+    ctx->echo_count = 0;
 
-    if (geom_result & XNegative) {
-	if (geom_result & WidthValue) {
-	    x = display_width - width + x;
-	} else {
-	    width = display_width + x;
-	    x = 0;
-	}
-    } 
-    if (geom_result & YNegative) {
-	if (geom_result & HeightValue) {
-	    y = display_height - height + y;
-	} else {
-	    height = display_height + y;
-	    y = 0;
+    if (gVerbose) fprintf (stderr, "hhpc: cleaning %d area(s)\n", count);
+
+    for (i = 0; i < count; i++) {
+	ctx->backend->update (ctx, &ctx->ghost.rects[i], waveClean);
+	gStats.pixels += rectArea (&ctx->ghost.rects[i]);
+    }
+    gStats.rects += count;
+    gStats.cleanups += count;
+
+    XFlush (ctx->dpy);
+}
+
+/*
+ * Takes a damage event, returns 0 if it is something else. The rectangle
+ * joins the pending damage, except for the X backend's window painting
+ * its own area when it is mapped: that is expected back once for every
+ * update of the frame. Anything else, clients repainting what the window
+ * exposed included, is refreshed like all damage.
+ */
+int
+xrefreshDamageEvent(struct refresh_ctx *ctx, XEvent *event)
+{
+    XRectangle area;
+    struct rect r;
+    int i;
+
+    if (!ctx->damage_interval || event->type != ctx->damage_event) return 0;
+
+#ifdef HAVE_XDAMAGE
+    area = ((XDamageNotifyEvent *) event)->area;
+#else
+    memset (&area, 0, sizeof (area));	/* there is no watching without it */
+#endif
+
+    r.x = area.x;
+    r.y = area.y;
+    r.width = area.width;
+    r.height = area.height;
+
+    gStats.damage++;
+
+    for (i = 0; i < ctx->echo_count; i++) {
+	if (rectContains (&ctx->echo[i], &r)) {
+	    ctx->echo[i] = ctx->echo[--ctx->echo_count];
+	    gStats.echoes++;
+	    return 1;
 	}
     }
 
-    mask = 0;
-    switch (action) {
-	case doBlack:
-	    xswa.background_pixel = BlackPixel (dpy, screen);
-	    mask |= CWBackPixel;
-	    break;
-	case doWhite:
-	    xswa.background_pixel = WhitePixel (dpy, screen);
-	    mask |= CWBackPixel;
-	    break;
-	case doSolid:
-	    cmap = DefaultColormap (dpy, screen);
-	    if (XParseColor (dpy, cmap, solidcolor, &cdef) &&
-		XAllocColor (dpy, cmap, &cdef)) {
-		xswa.background_pixel = cdef.pixel;
-		mask |= CWBackPixel;
-	    } else {
-		fprintf (stderr,"%s:  unable to allocate color '%s'.\n",
-			 ProgramName, solidcolor);
-		action = doNone;
-	    }
-	    break;
-	case doDefault:
-	case doNone:
-	    xswa.background_pixmap = None;
-	    mask |= CWBackPixmap;
-	    break;
-	case doRoot:
-	    xswa.background_pixmap = ParentRelative;
-	    mask |= CWBackPixmap;
-	    break;
+    /*
+     * the client drew over our cursor, what it saved from underneath is
+     * stale; it is drawn again with the refresh
+     */
+    if (ctx->cursor && ctx->cursor->shown && rectTouches (&ctx->cursor->drawn, &r))
+	ctx->cursor->shown = 0;
+
+    /*
+     * damage tends to come in bursts, the first after a quiet spell waits
+     * out the interval too so the rest of the burst joins it
+     */
+    if (!ctx->damage.count && elapsedMs (&ctx->damage_last) >= ctx->damage_interval)
+	clock_gettime (CLOCK_MONOTONIC, &ctx->damage_last);
+
+    dirtyAdd (&ctx->damage, &r);
+
+    return 1;
+}
+
+/*
+ * Takes the damage events that are waiting, for the input modes that
+ * don't go through every X event themselves. Returns how many there were.
+ */
+int
+xrefreshDamageDrain(struct refresh_ctx *ctx)
+{
+    XEvent event;
+    int count = 0;
+
+    if (!ctx->damage_interval) return 0;
+
+    while (XCheckTypedEvent (ctx->dpy, ctx->damage_event, &event)) {
+	xrefreshDamageEvent (ctx, &event);
+	count++;
     }
-    xswa.override_redirect = True;
-    xswa.backing_store = NotUseful;
-    xswa.save_under = False;
-    mask |= (CWOverrideRedirect | CWBackingStore | CWSaveUnder);
+
+    return count;
+}
+
+/*
+ * Milliseconds until the pending damage is due to be refreshed, -1 if
+ * there is none.
+ */
+long
+xrefreshDamageDue(struct refresh_ctx *ctx)
+{
+    long left;
+
+    if (!ctx->damage.count) return -1;
+
+    left = ctx->damage_interval - elapsedMs (&ctx->damage_last);
+
+    return left > 0 ? left : 0;
+}
+
+/*
+ * Refreshes the pending damage on its own, for when the pointer is not
+ * moving to take it along.
+ */
+void
+xrefreshDamage(struct refresh_ctx *ctx)
+{
+    if (!ctx->damage.count) return;
+
+    ctx->dirty = ctx->damage;
+    ctx->damage.count = 0;
+
+    if (ctx->cursor && !ctx->cursor->shown && ctx->pointer_x >= 0) {
+	cursorShow (ctx->cursor, &ctx->fb, ctx->pointer_x, ctx->pointer_y);
+	dirtyAdd (&ctx->dirty, &ctx->cursor->drawn);
+    }
+
+    if (gVerbose) fprintf (stderr, "hhpc: refreshing %d damaged area(s)\n", ctx->dirty.count);
+
+    xrefreshRegion (ctx, &ctx->dirty, 0);
+    gStats.damageRefreshes++;
+    clock_gettime (CLOCK_MONOTONIC, &ctx->damage_last);
+
+    XFlush (ctx->dpy);
+}
+
+/*
+ * The X backend: an override-redirect window that is mapped and unmapped
+ * over the area, the exposures it leaves behind make the e-ink driver
+ * update it.
+ */
+static int
+xwinInit(struct refresh_ctx *ctx)
+{
+    Visual visual;
+
     visual.visualid = CopyFromParent;
 
-XQueryPointer(dpy, XRootWindow(dpy, screen),
-        &child_win, &root_win,
-        &root_x, &root_y, &win_x, &win_y, &query_mask);
-fprintf (stderr,"root_x = %d, root_y=%d, win_x=%d, win_y=%d\n",
-			 root_x, root_y, win_x, win_y);
-    Window win = XCreateWindow(dpy, DefaultRootWindow(dpy), 0, 0, display_width,display_height,
-	    0, DefaultDepth(dpy, screen), InputOutput, &visual, mask, &xswa);
-//Window win = XCreateWindow(dpy, DefaultRootWindow(dpy), x, y, width, height,
-//	    0, DefaultDepth(dpy, screen), InputOutput, &visual, mask, &xswa);
+    ctx->win = XCreateWindow(ctx->dpy, ctx->root, ctx->x, ctx->y, ctx->width, ctx->height,
+	    0, DefaultDepth(ctx->dpy, ctx->screen), InputOutput, &visual, ctx->xswa_mask, &ctx->xswa);
+    ctx->win_x = ctx->x;
+    ctx->win_y = ctx->y;
+    ctx->win_width = ctx->width;
+    ctx->win_height = ctx->height;
+
+    return ctx->win != None;
+}
+
+/*
+ * The X server's e-ink driver picks the waveform itself, a cleanup is just
+ * another exposure of the area.
+ */
+static void
+xwinUpdate(struct refresh_ctx *ctx, const struct rect *r, enum e_waveform wave)
+{
+    Display *dpy = ctx->dpy;
+
+    if (r->x != ctx->win_x || r->y != ctx->win_y ||
+	r->width != ctx->win_width || r->height != ctx->win_height) {
+	XMoveResizeWindow (dpy, ctx->win, r->x, r->y, r->width, r->height);
+	ctx->win_x = r->x;
+	ctx->win_y = r->y;
+	ctx->win_width = r->width;
+	ctx->win_height = r->height;
+    }
 
     /*
      * at some point, we really ought to go walk the tree and turn off 
      * backing store;  or do a ClearArea generating exposures on all windows
      */
-    XMapWindow (dpy, win);
-    XDestroyWindow( dpy, win);
+    XMapWindow (dpy, ctx->win);
+    XUnmapWindow (dpy, ctx->win);
 
+    /* mapping paints the window's area, which comes back as damage */
+    if (ctx->damage_interval && ctx->echo_count < MAX_DIRTY)
+	ctx->echo[ctx->echo_count++] = *r;
+}
+
+static void
+xwinDestroy(struct refresh_ctx *ctx)
+{
+    if (ctx->win != None) XDestroyWindow (ctx->dpy, ctx->win);
+
+    ctx->win = None;
+}
+
+/*
+ * The framebuffer backend talks to the EPDC driver directly: a partial
+ * update of just the rectangle, without going through the X server. The
+ * definitions are the ones from the Kindle (wario) kernel's mxcfb.h. The
+ * framebuffer is assumed to share the orientation of the X screen.
+ */
+struct mxcfb_rect {
+    __u32 top;
+    __u32 left;
+    __u32 width;
+    __u32 height;
+};
+
+struct mxcfb_alt_buffer_data {
+    __u32 phys_addr;
+    __u32 width;
+    __u32 height;
+    struct mxcfb_rect alt_update_region;
+};
+
+struct mxcfb_update_data {
+    struct mxcfb_rect update_region;
+    __u32 waveform_mode;
+    __u32 update_mode;
+    __u32 update_marker;
+    __u32 hist_bw_waveform_mode;
+    __u32 hist_gray_waveform_mode;
+    int temp;
+    unsigned int flags;
+    struct mxcfb_alt_buffer_data alt_buffer_data;
+};
+
+#define MXCFB_SEND_UPDATE       _IOW('F', 0x2E, struct mxcfb_update_data)
+
+#define WAVEFORM_MODE_DU        0x1
+#define WAVEFORM_MODE_GC16      0x2
+#define WAVEFORM_MODE_AUTO      257
+#define UPDATE_MODE_PARTIAL     0x0
+#define UPDATE_MODE_FULL        0x1
+#define TEMP_USE_AMBIENT        0x1000
+
+static int
+fbMap(struct fb_mem *fb, int fd, int width, int height, int stride, int bpp)
+{
+    fb->fd     = fd;
+    fb->width  = width;
+    fb->height = height;
+    fb->stride = stride;
+    fb->bpp    = bpp;
+    fb->size   = (size_t) stride * height;
+    fb->base   = mmap (NULL, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (fb->base == MAP_FAILED) {
+	perror ("hhpc: could not map the framebuffer");
+	fb->base = NULL;
+	return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * clips a rectangle to the framebuffer, returns 0 if nothing is left
+ */
+static int
+fbClip(const struct fb_mem *fb, const struct rect *r, struct rect *out)
+{
+    int x1 = r->x + r->width, y1 = r->y + r->height;
+
+    out->x = r->x < 0 ? 0 : r->x;
+    out->y = r->y < 0 ? 0 : r->y;
+    out->width  = (x1 > fb->width  ? fb->width  : x1) - out->x;
+    out->height = (y1 > fb->height ? fb->height : y1) - out->y;
+
+    return out->width > 0 && out->height > 0;
+}
+
+static int
+fbInit(struct refresh_ctx *ctx)
+{
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+    const char *path = ctx->device ? ctx->device : "/dev/fb0";
+    int fd;
+
+    fd = open (path, O_RDWR);
+    if (fd == -1) {
+	fprintf (stderr, "hhpc: could not open %s: %s\n", path, strerror (errno));
+	return 0;
+    }
+
+    if (ioctl (fd, FBIOGET_VSCREENINFO, &vinfo) == -1 ||
+	ioctl (fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
+	fprintf (stderr, "hhpc: %s is not a framebuffer: %s\n", path, strerror (errno));
+	close (fd);
+	return 0;
+    }
+
+    if (gVerbose) fprintf (stderr, "hhpc: framebuffer %s is %ux%u, %u bpp\n",
+			   path, vinfo.xres, vinfo.yres, vinfo.bits_per_pixel);
+
+    if (!fbMap (&ctx->fb, fd, vinfo.xres, vinfo.yres, finfo.line_length, vinfo.bits_per_pixel)) {
+	close (fd);
+	return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * fast is DU, black and white only but the quickest there is, a cleanup
+ * is a flashing GC16
+ */
+static void
+fbUpdate(struct refresh_ctx *ctx, const struct rect *r, enum e_waveform wave)
+{
+    struct mxcfb_update_data upd;
+    struct rect clip;
+
+    if (!fbClip (&ctx->fb, r, &clip)) return;
+
+    memset (&upd, 0, sizeof(upd));
+    upd.update_region.top    = clip.y;
+    upd.update_region.left   = clip.x;
+    upd.update_region.width  = clip.width;
+    upd.update_region.height = clip.height;
+    upd.waveform_mode = wave == waveFast ? WAVEFORM_MODE_DU :
+			wave == waveClean ? WAVEFORM_MODE_GC16 : WAVEFORM_MODE_AUTO;
+    upd.update_mode   = wave == waveClean ? UPDATE_MODE_FULL : UPDATE_MODE_PARTIAL;
+    upd.update_marker = ++ctx->fb.marker;
+    upd.temp          = TEMP_USE_AMBIENT;
+
+    if (ioctl (ctx->fb.fd, MXCFB_SEND_UPDATE, &upd) == -1) {
+	if (gVerbose) perror ("hhpc: MXCFB_SEND_UPDATE");
+    }
+}
+
+static void
+fbDestroy(struct refresh_ctx *ctx)
+{
+    if (ctx->fb.base) munmap (ctx->fb.base, ctx->fb.size);
+    if (ctx->fb.fd != -1) close (ctx->fb.fd);
+
+    ctx->fb.base = NULL;
+    ctx->fb.fd = -1;
+}
+
+/*
+ * The fake backend maps a plain 8 bpp file the size of the X screen. An
+ * update reads the rectangle back the way the panel controller would,
+ * which makes it usable for testing and benchmarking on any Linux box.
+ */
+static int
+fakefbInit(struct refresh_ctx *ctx)
+{
+    const char *path = ctx->device ? ctx->device : "hhpc-fakefb";
+    int width = ctx->display_width, height = ctx->display_height;
+    int fd;
+
+    fd = open (path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+	fprintf (stderr, "hhpc: could not open %s: %s\n", path, strerror (errno));
+	return 0;
+    }
+
+    if (ftruncate (fd, (off_t) width * height) == -1) {
+	fprintf (stderr, "hhpc: could not size %s: %s\n", path, strerror (errno));
+	close (fd);
+	return 0;
+    }
 
- 
+    if (!fbMap (&ctx->fb, fd, width, height, width, 8)) {
+	close (fd);
+	return 0;
+    }
+
+    return 1;
+}
+
+static void
+fakefbUpdate(struct refresh_ctx *ctx, const struct rect *r, enum e_waveform wave)
+{
+    static const char *waves[] = { "auto", "fast", "clean" };
+    struct rect clip;
+    const unsigned char *line;
+    unsigned int sum = 0;
+    int row, col;
+
+    if (!fbClip (&ctx->fb, r, &clip)) return;
+
+    for (row = 0; row < clip.height; row++) {
+	line = ctx->fb.base + (size_t) (clip.y + row) * ctx->fb.stride + clip.x;
+	for (col = 0; col < clip.width; col++) {
+	    sum += line[col];
+	}
+    }
+
+    ctx->fb.marker++;
+
+    if (gVerbose) fprintf (stderr, "hhpc: fake %s update %u: %dx%d+%d+%d (%08x)\n",
+			   waves[wave], ctx->fb.marker, clip.width, clip.height, clip.x, clip.y, sum);
+}
+
+static const struct refresh_backend backends[] = {
+    { "x",    xwinInit,   xwinUpdate,   xwinDestroy },
+    { "fb",   fbInit,     fbUpdate,     fbDestroy },
+    { "fake", fakefbInit, fakefbUpdate, fbDestroy },
+};
+
+const struct refresh_backend *
+findBackend(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+	if (strcmp (backends[i].name, name) == 0) return &backends[i];
+    }
 
+    return NULL;
 }
\ No newline at end of file
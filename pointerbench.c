@@ -0,0 +1,377 @@
+/*
+ * pointerbench: runs pointer against a headless Xvfb server, drives the X
+ * pointer through scripted paths with XTest and reports what it cost.
+ *
+ *   pointerbench [-d display] [-p pointer] [-r] [-x Xvfb] [-v] -- [pointer options]
+ *
+ * Everything after -- is handed to pointer, which lets the same script be
+ * run against the grab loop, xi2, the different backends and rates. The
+ * numbers come from pointer's own stats (-S), taken with SIGUSR1 once the
+ * script has played, and from its CPU time in /proc. With -r the script
+ * also paints small rectangles on the root window as it goes, standing in
+ * for clients repainting, which gives pointer -d damage to refresh.
+ */
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define SCREEN_WIDTH  1072
+#define SCREEN_HEIGHT 1448
+
+#define STAT_BUCKETS 12
+
+static const char *gDisplay = ":99";
+static const char *gPointer = "./pointer";
+static const char *gXvfb    = "Xvfb";
+static int gVerbose         = 0;
+static int gRepaint         = 0;
+
+/**
+ * one leg of the script: count moves of dx,dy, interval ms apart,
+ * optionally with the first button held down
+ */
+struct step {
+    const char *name;
+    int dx, dy;
+    int count;
+    long interval;
+    int button;
+};
+
+static const struct step script[] = {
+    { "slow drag",       2,   1, 200, 10, 1 },
+    { "idle",            0,   0,   1, 1000, 0 },
+    { "fast flick",     40,  30,  20,  5, 0 },
+    { "idle",            0,   0,   1, 1000, 0 },
+    { "fast flick back", -40, -30, 20,  5, 0 },
+    { "idle",            0,   0,   1, 1000, 0 },
+    { "slow diagonal",   1,   2, 300, 16, 0 },
+    { "idle",            0,   0,   1, 1000, 0 },
+};
+
+/**
+ * what pointer reported, see statsWrite() in pointer.c
+ */
+struct pointer_stats {
+    unsigned long events, wakeups, refreshes, rects, roundtrips, requests;
+    unsigned long long pixels;
+    unsigned long total[STAT_BUCKETS];
+    unsigned long damage, echoes, damageRefreshes;
+};
+
+static const long statBounds[STAT_BUCKETS - 1] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000 };
+
+static void delay(long msec) {
+    struct timespec sleep;
+
+    sleep.tv_sec  = msec / 1000;
+    sleep.tv_nsec = (msec % 1000) * 1000 * 1000;
+
+    while (nanosleep(&sleep, &sleep) == -1 && errno == EINTR);
+}
+
+static pid_t spawn(char *const argv[]) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        setenv("DISPLAY", gDisplay, 1);
+        execvp(argv[0], argv);
+        fprintf(stderr, "pointerbench: could not run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    if (pid == -1) perror("pointerbench: fork");
+
+    return pid;
+}
+
+static void stop(pid_t pid) {
+    if (pid <= 0) return;
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * user plus system time of a process in milliseconds, -1 if unknown
+ */
+static long cpuTime(pid_t pid) {
+    char path[64], buf[1024], *p;
+    unsigned long utime, stime;
+    FILE *fp;
+    size_t len;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = 0;
+
+    /* skip past the command name, it may contain spaces */
+    p = strrchr(buf, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+
+    return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+static int readStats(const char *path, struct pointer_stats *st) {
+    char line[512], *tok;
+    FILE *fp;
+    int b, ok = 0;
+
+    memset(st, 0, sizeof(*st));
+
+    fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "events %lu wakeups %lu refreshes %lu rects %lu pixels %llu roundtrips %lu requests %lu",
+                   &st->events, &st->wakeups, &st->refreshes, &st->rects, &st->pixels,
+                   &st->roundtrips, &st->requests) == 7) {
+            ok = 1;
+        }
+        else if (sscanf(line, "damage n %lu echoes %lu refreshes %lu",
+                        &st->damage, &st->echoes, &st->damageRefreshes) == 3) {
+            /* only there with -d */
+        }
+        else if (strncmp(line, "total ", 6) == 0 && (tok = strchr(line, '|')) != NULL) {
+            /* " <1:n <2:n ... >=2000:n" */
+            for (b = 0, tok = strtok(tok + 1, " \n"); tok && b < STAT_BUCKETS; tok = strtok(NULL, " \n"), ++b) {
+                tok = strchr(tok, ':');
+                if (tok) st->total[b] = strtoul(tok + 1, NULL, 10);
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return ok;
+}
+
+/**
+ * upper bound of the bucket the given percentile falls into, -1 for the
+ * open last bucket
+ */
+static long percentile(const struct pointer_stats *st, int pct) {
+    unsigned long count = 0, seen = 0;
+    int b;
+
+    for (b = 0; b < STAT_BUCKETS; ++b) count += st->total[b];
+    if (!count) return 0;
+
+    for (b = 0; b < STAT_BUCKETS - 1; ++b) {
+        seen += st->total[b];
+        if (seen * 100 >= count * pct) return statBounds[b];
+    }
+
+    return -1;
+}
+
+static void printPercentile(const char *name, long bound) {
+    if (bound < 0) printf("  %s >= %ld ms", name, statBounds[STAT_BUCKETS - 2]);
+    else printf("  %s < %ld ms", name, bound);
+}
+
+/**
+ * plays the script, returns the number of X input events it generated and
+ * the rectangles painted in painted
+ */
+static unsigned long play(Display *dpy, unsigned long *painted) {
+    Window root = DefaultRootWindow(dpy);
+    GC gc = XCreateGC(dpy, root, 0, NULL);
+    unsigned long sent = 0;
+    size_t i;
+    int n, x = SCREEN_WIDTH / 4, y = SCREEN_HEIGHT / 4;
+
+    *painted = 0;
+
+    XTestFakeMotionEvent(dpy, -1, x, y, CurrentTime);
+    XSync(dpy, False);
+    delay(500);
+
+    for (i = 0; i < sizeof(script) / sizeof(script[0]); ++i) {
+        const struct step *st = &script[i];
+
+        if (gVerbose) fprintf(stderr, "pointerbench: %s\n", st->name);
+
+        if (st->button) {
+            XTestFakeButtonEvent(dpy, 1, True, CurrentTime);
+            sent++;
+        }
+
+        for (n = 0; n < st->count; ++n) {
+            if (st->dx || st->dy) {
+                x += st->dx;
+                y += st->dy;
+
+                if (x < 0) x = 0;
+                if (y < 0) y = 0;
+                if (x >= SCREEN_WIDTH)  x = SCREEN_WIDTH - 1;
+                if (y >= SCREEN_HEIGHT) y = SCREEN_HEIGHT - 1;
+
+                XTestFakeMotionEvent(dpy, -1, x, y, CurrentTime);
+                sent++;
+            }
+
+            /* a blinking caret's worth, near the pointer and away from it */
+            if (gRepaint) {
+                XSetForeground(dpy, gc, *painted & 1 ? BlackPixel(dpy, 0) : WhitePixel(dpy, 0));
+                XFillRectangle(dpy, root, gc, *painted & 2 ? x + 20 : SCREEN_WIDTH - x / 2, y, 8, 16);
+                (*painted)++;
+            }
+
+            XFlush(dpy);
+            delay(st->interval);
+        }
+
+        if (st->button) {
+            XTestFakeButtonEvent(dpy, 1, False, CurrentTime);
+            sent++;
+            XFlush(dpy);
+        }
+    }
+
+    XFreeGC(dpy, gc);
+
+    return sent;
+}
+
+static int parseOptions(int argc, char *argv[]) {
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "d:p:rx:v")) != -1) {
+        switch (option) {
+            case 'd': gDisplay = optarg; break;
+            case 'p': gPointer = optarg; break;
+            case 'r': gRepaint = 1; break;
+            case 'x': gXvfb = optarg; break;
+            case 'v': gVerbose = 1; break;
+            default: return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void usage() {
+    printf("pointerbench [-d display] [-p pointer] [-r] [-x Xvfb] [-v] -- [pointer options]\n");
+    printf("    -d  display to run Xvfb on, the default is :99\n");
+    printf("    -p  the pointer binary to benchmark, the default is ./pointer\n");
+    printf("    -r  paint on the root window along the script, for pointer -d\n");
+    printf("    -x  the Xvfb binary\n");
+}
+
+int main(int argc, char *argv[]) {
+    char statsFile[64];
+    char *xvfbArgv[] = { NULL, NULL, "-screen", "0", "1072x1448x8", "-nolisten", "tcp", NULL };
+    char **pointerArgv;
+    struct pointer_stats st;
+    Display *dpy = NULL;
+    pid_t xvfb, pointer;
+    unsigned long sent, painted;
+    long cpu;
+    int event, error, major, minor;
+    int i, n, tries;
+
+    if (!parseOptions(argc, argv)) {
+        usage();
+
+        return 1;
+    }
+
+    snprintf(statsFile, sizeof(statsFile), "/tmp/pointerbench-%d.stats", (int) getpid());
+
+    xvfbArgv[0] = (char *) gXvfb;
+    xvfbArgv[1] = (char *) gDisplay;
+
+    xvfb = spawn(xvfbArgv);
+    if (xvfb == -1) return 1;
+
+    for (tries = 0; tries < 50 && !dpy; ++tries) {
+        delay(100);
+        dpy = XOpenDisplay(gDisplay);
+    }
+
+    if (!dpy) {
+        fprintf(stderr, "pointerbench: Xvfb did not come up on %s\n", gDisplay);
+        stop(xvfb);
+        return 1;
+    }
+
+    if (!XTestQueryExtension(dpy, &event, &error, &major, &minor)) {
+        fprintf(stderr, "pointerbench: the XTEST extension is not available\n");
+        XCloseDisplay(dpy);
+        stop(xvfb);
+        return 1;
+    }
+
+    /* pointer, its own options and the stats file */
+    pointerArgv = calloc(argc - optind + 4, sizeof(char *));
+    n = 0;
+    pointerArgv[n++] = (char *) gPointer;
+    for (i = optind; i < argc; ++i) pointerArgv[n++] = argv[i];
+    pointerArgv[n++] = "-S";
+    pointerArgv[n++] = statsFile;
+
+    pointer = spawn(pointerArgv);
+    if (pointer == -1) {
+        XCloseDisplay(dpy);
+        stop(xvfb);
+        return 1;
+    }
+
+    /* let it set up its window and grab */
+    delay(1000);
+
+    sent = play(dpy, &painted);
+
+    cpu = cpuTime(pointer);
+    kill(pointer, SIGUSR1);
+    delay(500);
+
+    if (!readStats(statsFile, &st)) {
+        fprintf(stderr, "pointerbench: no stats from %s\n", gPointer);
+        memset(&st, 0, sizeof(st));
+    }
+
+    stop(pointer);
+    XCloseDisplay(dpy);
+    stop(xvfb);
+    unlink(statsFile);
+    free(pointerArgv);
+
+    printf("pointer");
+    for (i = optind; i < argc; ++i) printf(" %s", argv[i]);
+    printf("\n");
+    printf("  events sent %lu, seen %lu, wakeups %lu\n", sent, st.events, st.wakeups);
+    if (cpu >= 0) printf("  cpu %ld ms, %.1f us/event\n", cpu, sent ? cpu * 1000.0 / sent : 0.0);
+    printf("  refreshes %lu, rects %lu, pixels %llu\n", st.refreshes, st.rects, st.pixels);
+    printf("  X requests %lu, round-trips %lu\n", st.requests, st.roundtrips);
+    if (gRepaint) {
+        printf("  painted %lu, damage seen %lu, own %lu, damage refreshes %lu\n",
+               painted, st.damage, st.echoes, st.damageRefreshes);
+    }
+    printf("  input to refresh:");
+    printPercentile("p50", percentile(&st, 50));
+    printPercentile("p90", percentile(&st, 90));
+    printPercentile("p99", percentile(&st, 99));
+    printf("\n");
+
+    return 0;
+}